@@ -0,0 +1,249 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hirediscc/hirediscc.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 6379;
+    std::string password;
+    std::string socket;
+    uint32_t requests = 100000;
+    uint32_t clients = 1;
+    uint32_t valueSize = 32;
+    uint32_t pipeline = 16;
+    hirediscc::Transport transport = hirediscc::Transport::Socket;
+    std::vector<std::string> tests;
+};
+
+// A workload issues one logical operation, made of batch requests; i is the
+// per-client operation index.
+using Workload = std::function<void(hirediscc::Client &client, uint32_t i)>;
+
+struct Benchmark {
+    char const *name;
+    Workload run;
+    uint32_t batch;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: hirediscc_bench [-h <host>] [-p <port>] [-s <socket>] [-a <password>]\n"
+        "                       [-n <requests>] [-c <clients>] [-d <size>] [-P <numreq>]\n"
+        "                       [-t <tests>] [-T <transport>]\n"
+        "\n"
+        " -h <host>      Server hostname (default 127.0.0.1)\n"
+        " -p <port>      Server port (default 6379)\n"
+        " -s <socket>    Server unix socket, overrides host and port (Client tests)\n"
+        " -a <password>  Password for AUTH\n"
+        " -n <requests>  Total number of requests (default 100000)\n"
+        " -c <clients>   Number of parallel connections (default 1)\n"
+        " -d <size>      Data size of SET/GET value in bytes (default 32)\n"
+        " -P <numreq>    Requests per batch in the pipelined tests (default 16)\n"
+        " -t <tests>     Comma separated list of tests to run (default all)\n"
+        " -T <transport> ASYNC_GET transport, socket or uring (default socket)\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return false;
+        }
+        char const *value = argv[++i];
+        if (arg == "-h") {
+            options.host = value;
+        } else if (arg == "-p") {
+            options.port = static_cast<uint16_t>(std::atoi(value));
+        } else if (arg == "-s") {
+            options.socket = value;
+        } else if (arg == "-a") {
+            options.password = value;
+        } else if (arg == "-n") {
+            options.requests = static_cast<uint32_t>(std::atol(value));
+        } else if (arg == "-c") {
+            options.clients = std::max(1, std::atoi(value));
+        } else if (arg == "-d") {
+            options.valueSize = static_cast<uint32_t>(std::atol(value));
+        } else if (arg == "-P") {
+            options.pipeline = std::max(1, std::atoi(value));
+        } else if (arg == "-T") {
+            options.transport = std::strcmp(value, "uring") == 0
+                ? hirediscc::Transport::IoUring
+                : hirediscc::Transport::Socket;
+        } else if (arg == "-t") {
+            std::stringstream stream(value);
+            std::string test;
+            while (std::getline(stream, test, ','))
+                options.tests.push_back(test);
+        } else {
+            usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool selected(Options const &options, char const *name) {
+    if (options.tests.empty())
+        return true;
+    auto equalsIgnoreCase = [](std::string const &lhs, char const *rhs) {
+        return lhs.size() == std::strlen(rhs)
+            && std::equal(lhs.begin(), lhs.end(), rhs, [](char a, char b) {
+                return std::toupper(static_cast<unsigned char>(a)) == std::toupper(static_cast<unsigned char>(b));
+            });
+    };
+    for (auto const &test : options.tests) {
+        if (equalsIgnoreCase(test, name))
+            return true;
+    }
+    return false;
+}
+
+double percentile(std::vector<uint64_t> const &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    auto index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index] / 1000.0;
+}
+
+void runBenchmark(Options const &options, Benchmark const &benchmark) {
+    auto perClient = options.requests / options.clients / benchmark.batch;
+    std::vector<std::vector<uint64_t>> latencies(options.clients);
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+
+    for (uint32_t c = 0; c < options.clients; ++c) {
+        threads.emplace_back([&, c]() {
+            auto &samples = latencies[c];
+            samples.reserve(perClient);
+            try {
+                auto client = options.socket.empty()
+                    ? hirediscc::Client(options.host, options.port, options.password)
+                    : hirediscc::Client(hirediscc::UnixSocket { options.socket }, options.password);
+                for (uint32_t i = 0; i < perClient; ++i) {
+                    auto begin = Clock::now();
+                    benchmark.run(client, i);
+                    samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - begin).count());
+                }
+            } catch (hirediscc::Exception const &e) {
+                std::cerr << benchmark.name << ": " << e.what() << "\n";
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<uint64_t> merged;
+    for (auto const &samples : latencies)
+        merged.insert(merged.end(), samples.begin(), samples.end());
+    std::sort(merged.begin(), merged.end());
+
+    // Throughput counts requests, latencies are per operation (batch).
+    std::printf("%-12s %10.0f ops/sec  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n",
+        benchmark.name,
+        elapsed > 0 ? merged.size() * benchmark.batch / elapsed : 0.0,
+        percentile(merged, 0.50),
+        percentile(merged, 0.99),
+        percentile(merged, 0.999),
+        percentile(merged, 1.0));
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    std::string const value(options.valueSize, 'x');
+    std::string const key = "key:__hirediscc_bench__";
+
+    // Shared by every client thread of MUX_GET and ASYNC_GET.
+    std::unique_ptr<hirediscc::MultiplexedConnection> multiplexed;
+    if (selected(options, "MUX_GET"))
+        multiplexed = std::make_unique<hirediscc::MultiplexedConnection>(
+            options.host, options.port, options.password);
+    hirediscc::IoEngine engine(1, nullptr, options.transport);
+    std::unique_ptr<hirediscc::AsyncConnection> async;
+    if (selected(options, "ASYNC_GET"))
+        async = engine.connect(options.host, options.port, options.password);
+
+    std::vector<Benchmark> const benchmarks {
+        { "PING", [](hirediscc::Client &client, uint32_t) {
+            client.ping();
+        }, 1 },
+        { "SET", [&](hirediscc::Client &client, uint32_t) {
+            client.set(key, value);
+        }, 1 },
+        { "GET", [&](hirediscc::Client &client, uint32_t) {
+            client.get(key);
+        }, 1 },
+        { "GETVIEW", [&](hirediscc::Client &client, uint32_t) {
+            client.getView(key);
+        }, 1 },
+        { "PIPELINE_SET", [&](hirediscc::Client &client, uint32_t) {
+            auto pipeline = client.pipelined();
+            for (uint32_t i = 0; i < options.pipeline; ++i)
+                pipeline.add("SET", key, value);
+            pipeline.excute();
+        }, options.pipeline },
+        { "PIPELINE_GET", [&](hirediscc::Client &client, uint32_t) {
+            auto pipeline = client.pipelined(true);
+            for (uint32_t i = 0; i < options.pipeline; ++i)
+                pipeline.add<hirediscc::ReplyView>("GET", key);
+            pipeline.excute();
+        }, options.pipeline },
+        { "STREAM_SET", [&](hirediscc::Client &client, uint32_t) {
+            auto stream = client.stream([](hirediscc::ReplyView &) {});
+            for (uint32_t i = 0; i < options.pipeline * 64; ++i)
+                stream.add("SET", key, value);
+            stream.finish();
+        }, options.pipeline * 64 },
+        { "MUX_GET", [&](hirediscc::Client &, uint32_t) {
+            multiplexed->excute<hirediscc::ReplyView, hirediscc::commands::Get>(key);
+        }, 1 },
+        { "ASYNC_GET", [&](hirediscc::Client &, uint32_t) {
+            std::vector<std::future<hirediscc::ReplyView>> replies;
+            replies.reserve(options.pipeline);
+            for (uint32_t i = 0; i < options.pipeline; ++i)
+                replies.push_back(async->send<hirediscc::ReplyView, hirediscc::commands::Get>(key));
+            for (auto &reply : replies)
+                reply.get();
+        }, options.pipeline },
+    };
+
+    for (auto const &benchmark : benchmarks) {
+        if (selected(options, benchmark.name))
+            runBenchmark(options, benchmark);
+    }
+    return 0;
+}
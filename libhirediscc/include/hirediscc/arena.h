@@ -0,0 +1,48 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace hirediscc {
+
+// Bump allocator for the replies of one pipeline batch. Reply objects are
+// carved out of a few large chunks and never freed one by one; reset()
+// releases everything at once and keeps the chunks for the next batch.
+class ReplyArena {
+public:
+    enum {
+        DefaultChunkSize = 64 * 1024
+    };
+
+    explicit ReplyArena(size_t chunkSize = DefaultChunkSize);
+
+    ~ReplyArena();
+
+    ReplyArena(ReplyArena const &) = delete;
+    ReplyArena& operator=(ReplyArena const &) = delete;
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    void reset() noexcept;
+
+    size_t bytesAllocated() const noexcept;
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    size_t const chunkSize_;
+    std::vector<Chunk> chunks_;
+    size_t current_;
+    size_t offset_;
+};
+
+}
@@ -0,0 +1,356 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include <hirediscc/reply.h>
+#include <hirediscc/command.h>
+#include <hirediscc/connection.h>
+#include <hirediscc/reactor.h>
+
+struct redisAsyncContext;
+
+namespace hirediscc {
+
+// Called on the I/O thread with the reply, or with a null reply and the error
+// that failed the command. It must not block: every other reply on the
+// connection waits for it.
+template <typename R>
+using AsyncHandler = std::function<void(R *reply, std::exception_ptr error)>;
+
+namespace details {
+
+class AsyncWaiter {
+public:
+	virtual ~AsyncWaiter() = default;
+
+	// Takes ownership of reply.
+	virtual void resolve(redisReply *reply) = 0;
+
+	virtual void fail(std::exception_ptr error) = 0;
+
+	// Called once the connection is done with the waiter, after resolve()
+	// or fail().
+	virtual void dispose() {
+		delete this;
+	}
+};
+
+struct AsyncWaiterDisposer {
+	void operator()(AsyncWaiter *waiter) const {
+		waiter->dispose();
+	}
+};
+
+using AsyncWaiterPtr = std::unique_ptr<AsyncWaiter, AsyncWaiterDisposer>;
+
+template <typename R>
+class PromiseAsyncWaiter : public AsyncWaiter {
+public:
+	void resolve(redisReply *reply) override {
+		promise_.set_value(R(reply));
+	}
+
+	void fail(std::exception_ptr error) override {
+		promise_.set_exception(error);
+	}
+
+	std::future<R> future() {
+		return promise_.get_future();
+	}
+private:
+	std::promise<R> promise_;
+};
+
+template <typename R>
+class HandlerAsyncWaiter : public AsyncWaiter {
+public:
+	explicit HandlerAsyncWaiter(AsyncHandler<R> handler)
+		: handler_(std::move(handler)) {
+	}
+
+	void resolve(redisReply *reply) override {
+		R result(reply);
+		handler_(&result, nullptr);
+	}
+
+	void fail(std::exception_ptr error) override {
+		handler_(nullptr, error);
+	}
+private:
+	AsyncHandler<R> handler_;
+};
+
+template <typename R, typename Encode>
+class AsyncAwaiter;
+
+}
+
+// A connection driven by hiredis' redisAsyncContext on an event loop thread,
+// either its own or a Reactor shared with other connections. Commands can be
+// sent from any thread; they are queued, handed to the loop and answered
+// through a future or a handler, so a single thread keeps any number of
+// requests in flight without blocking the callers.
+//
+// A connection error fails every outstanding command and all later ones;
+// create a new AsyncConnection to reconnect. The connection must not be
+// destroyed from its own reactor thread.
+class AsyncConnection {
+public:
+	struct Stats {
+		uint64_t commands;
+		uint64_t writes;
+	};
+
+	// Waits up to timeout seconds for the connection to be established and,
+	// with a password, for AUTH to be accepted. Throws when either fails.
+	AsyncConnection(std::string const &host,
+		uint16_t port,
+		std::string const &password = "",
+		uint32_t timeout = Connection::DefaultTimeout);
+
+	// As above, on reactor. Handlers and coroutines are run through executor
+	// when one is given, on the reactor thread otherwise.
+	AsyncConnection(Reactor &reactor,
+		std::string const &host,
+		uint16_t port,
+		std::string const &password = "",
+		uint32_t timeout = Connection::DefaultTimeout,
+		Executor executor = nullptr);
+
+	AsyncConnection(AsyncConnection const &) = delete;
+	AsyncConnection& operator=(AsyncConnection const &) = delete;
+
+	// Waits for the commands already queued to be answered.
+	~AsyncConnection();
+
+	template <typename R = ReplyString, typename T, typename... Args>
+	std::future<R> send(T const &arg, Args const &... args);
+
+	template <typename R, auto const &Name, typename... Args>
+	std::future<R> send(Args const &... args);
+
+	template <typename R = ReplyString, typename T, typename... Args>
+	void post(AsyncHandler<R> handler, T const &arg, Args const &... args);
+
+	template <typename R, auto const &Name, typename... Args>
+	void post(AsyncHandler<R> handler, Args const &... args);
+
+	// Number of commands sent and of socket writes that carried them.
+	Stats stats() const noexcept {
+		return Stats { commands_.load(), writes_.load() };
+	}
+private:
+	friend class Reactor;
+
+	template <typename R, typename Encode>
+	friend class details::AsyncAwaiter;
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Request {
+		size_t size;
+		details::AsyncWaiterPtr waiter;
+	};
+
+	// Fails waiter at once if the connection has failed.
+	template <typename Encode>
+	void enqueue(details::AsyncWaiterPtr waiter, Encode encode);
+
+	// Queues waiter, which the connection then owns. When the connection has
+	// failed the error is returned instead, and waiter is left to the caller
+	// untouched, as it is when encode throws.
+	template <typename Encode>
+	std::exception_ptr tryEnqueue(details::AsyncWaiter *waiter, Encode &encode);
+
+	void open(std::string const &host, uint16_t port, std::string const &password, uint32_t timeout);
+	// Disconnects once the queued commands are answered and waits until the
+	// reactor lets go of the connection.
+	void shutdown();
+
+	// Called on the reactor thread.
+	void service();
+	void handle(bool readable, bool writable, bool failed);
+	bool expire(Clock::time_point now);
+	void close();
+	void release();
+	void submit(std::string const &requests, std::deque<Request> &waiters);
+	void complete(details::AsyncWaiterPtr waiter, redisReply *reply, std::exception_ptr error);
+
+	static void onConnect(redisAsyncContext const *context, int status);
+	static void onReply(redisAsyncContext *context, void *reply, void *privdata);
+	void interest(bool &flag, bool value);
+
+	static void addRead(void *privdata);
+	static void delRead(void *privdata);
+	static void addWrite(void *privdata);
+	static void delWrite(void *privdata);
+	static void cleanup(void *privdata);
+
+	std::unique_ptr<Reactor> ownReactor_;
+	Reactor *reactor_;
+	Executor executor_;
+
+	// Owned by the reactor thread.
+	redisAsyncContext *context_;
+	Reactor::Channel *channel_;
+	bool reading_;
+	bool writing_;
+	// Queued for Reactor::update().
+	bool dirty_;
+	// Registered with the reactor's epoll, for events_.
+	bool watched_;
+	uint32_t events_;
+	bool disconnecting_;
+	bool closing_;
+	int lastError_;
+	Clock::time_point deadline_;
+	bool connectDone_;
+	std::promise<void> connected_;
+	std::promise<void> released_;
+
+	std::mutex mutex_;
+	std::string pending_;
+	std::deque<Request> waiters_;
+	bool stopped_;
+	// An event for the connection is on its way to the reactor.
+	bool woken_;
+	std::exception_ptr error_;
+	std::atomic<uint64_t> commands_;
+	std::atomic<uint64_t> writes_;
+};
+
+template <typename Encode>
+inline void AsyncConnection::enqueue(details::AsyncWaiterPtr waiter, Encode encode) {
+	// Handlers may send again, so they run without the lock.
+	if (auto error = tryEnqueue(waiter.get(), encode))
+		waiter->fail(error);
+	else
+		waiter.release();
+}
+
+template <typename Encode>
+inline std::exception_ptr AsyncConnection::tryEnqueue(details::AsyncWaiter *waiter, Encode &encode) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (error_)
+			return error_;
+		auto size = pending_.size();
+		try {
+			encode(pending_);
+			waiters_.push_back(Request { pending_.size() - size, nullptr });
+		} catch (...) {
+			pending_.resize(size);
+			throw;
+		}
+		// Taken only once nothing can throw, so a failure never disposes of it.
+		waiters_.back().waiter.reset(waiter);
+		if (!woken_) {
+			woken_ = true;
+			reactor_->schedule(Reactor::Event::Work, this);
+		}
+	}
+	++commands_;
+	return nullptr;
+}
+
+template <typename R, typename T, typename... Args>
+inline std::future<R> AsyncConnection::send(T const &arg, Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	auto waiter = new details::PromiseAsyncWaiter<R>();
+	auto future = waiter->future();
+	enqueue(details::AsyncWaiterPtr(waiter), [&](std::string &buffer) {
+		CommandEncoder(buffer).encode(arg, args...);
+	});
+	return future;
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline std::future<R> AsyncConnection::send(Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	auto waiter = new details::PromiseAsyncWaiter<R>();
+	auto future = waiter->future();
+	enqueue(details::AsyncWaiterPtr(waiter), [&](std::string &buffer) {
+		CommandEncoder(buffer).encode<Name>(args...);
+	});
+	return future;
+}
+
+template <typename R, typename T, typename... Args>
+inline void AsyncConnection::post(AsyncHandler<R> handler, T const &arg, Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	enqueue(details::AsyncWaiterPtr(new details::HandlerAsyncWaiter<R>(std::move(handler))), [&](std::string &buffer) {
+		CommandEncoder(buffer).encode(arg, args...);
+	});
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline void AsyncConnection::post(AsyncHandler<R> handler, Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	enqueue(details::AsyncWaiterPtr(new details::HandlerAsyncWaiter<R>(std::move(handler))), [&](std::string &buffer) {
+		CommandEncoder(buffer).encode<Name>(args...);
+	});
+}
+
+// The Client commands over an AsyncConnection, answered through futures.
+class AsyncClient {
+public:
+	AsyncClient(std::string const &host,
+		uint16_t port,
+		std::string const &password = "");
+
+	AsyncClient(IoEngine &engine,
+		std::string const &host,
+		uint16_t port,
+		std::string const &password = "");
+
+	std::future<ReplyString> ping() {
+		return connection_->send<ReplyString, commands::Ping>();
+	}
+
+	template <typename T>
+	std::future<ReplyString> set(std::string const &key, T value) {
+		return connection_->send<ReplyString, commands::Set>(key, value);
+	}
+
+	template <typename T>
+	std::future<ReplyString> echo(T message) {
+		return connection_->send<ReplyString, commands::Echo>(message);
+	}
+
+	std::future<ReplyString> get(std::string const &key) {
+		return connection_->send<ReplyString, commands::Get>(key);
+	}
+
+	template <typename T, typename... Args>
+	std::future<ReplyInterger> del(T arg, Args const &... args) {
+		return connection_->send<ReplyInterger, commands::Del>(arg, args...);
+	}
+
+	AsyncConnection &connection() noexcept {
+		return *connection_;
+	}
+private:
+	std::unique_ptr<AsyncConnection> connection_;
+};
+
+}
@@ -0,0 +1,171 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+// Coroutine support needs C++20; the rest of the library builds as C++17 and
+// this header is empty there.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define HIREDISCC_HAS_COROUTINES 1
+#endif
+
+#ifdef HIREDISCC_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <hirediscc/reply.h>
+#include <hirediscc/asyncclient.h>
+
+namespace hirediscc {
+
+namespace details {
+
+// Lives in the awaiting coroutine's frame and is queued on the connection as
+// it is, so a command costs no allocation of its own. The coroutine resumes on
+// the connection's I/O thread once the reply is in.
+//
+// The command arguments are encoded when the coroutine suspends, so the
+// awaiter has to be awaited in the expression that created it.
+template <typename R, typename Encode>
+class AsyncAwaiter : public AsyncWaiter {
+public:
+	AsyncAwaiter(AsyncConnection &connection, Encode encode)
+		: connection_(connection)
+		, encode_(std::move(encode))
+		, reply_(nullptr) {
+	}
+
+	AsyncAwaiter(AsyncAwaiter const &) = delete;
+	AsyncAwaiter& operator=(AsyncAwaiter const &) = delete;
+
+	~AsyncAwaiter() {
+		details::deleteRedisReply(reply_);
+	}
+
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	// Once the command is queued the coroutine may already be running again,
+	// on any thread, so this is not touched afterwards. On a failed
+	// connection it goes on at once with the error instead, and when encode
+	// throws, with that exception.
+	bool await_suspend(std::coroutine_handle<> handle) {
+		handle_ = handle;
+		auto error = connection_.tryEnqueue(this, encode_);
+		if (!error)
+			return true;
+		error_ = error;
+		return false;
+	}
+
+	R await_resume() {
+		if (error_)
+			std::rethrow_exception(error_);
+		return R(std::exchange(reply_, nullptr));
+	}
+
+	void resolve(redisReply *reply) override {
+		reply_ = reply;
+	}
+
+	void fail(std::exception_ptr error) override {
+		error_ = error;
+	}
+
+	void dispose() override {
+		handle_.resume();
+	}
+private:
+	AsyncConnection &connection_;
+	Encode encode_;
+	std::coroutine_handle<> handle_;
+	redisReply *reply_;
+	std::exception_ptr error_;
+};
+
+}
+
+// co_await awaitCommand<R>(connection, "GET", key) sends the command and
+// suspends the coroutine until its reply arrives.
+template <typename R = ReplyString, typename T, typename... Args>
+inline auto awaitCommand(AsyncConnection &connection, T const &arg, Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	auto encode = [&](std::string &buffer) {
+		CommandEncoder(buffer).encode(arg, args...);
+	};
+	return details::AsyncAwaiter<R, decltype(encode)>(connection, encode);
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline auto awaitCommand(AsyncConnection &connection, Args const &... args) {
+	static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+		"ReplyBuilder replies are not supported by AsyncConnection");
+	auto encode = [&](std::string &buffer) {
+		CommandEncoder(buffer).encode<Name>(args...);
+	};
+	return details::AsyncAwaiter<R, decltype(encode)>(connection, encode);
+}
+
+// The Client commands for coroutines: co_await client.get(key) suspends on
+// send and resumes on the connection's I/O thread with the reply, so a few
+// threads can drive any number of concurrent requests.
+class AwaitableClient {
+public:
+	AwaitableClient(std::string const &host,
+		uint16_t port,
+		std::string const &password = "")
+		: connection_(std::make_unique<AsyncConnection>(host, port, password)) {
+	}
+
+	AwaitableClient(IoEngine &engine,
+		std::string const &host,
+		uint16_t port,
+		std::string const &password = "")
+		: connection_(engine.connect(host, port, password)) {
+	}
+
+	auto ping() {
+		return awaitCommand<ReplyString, commands::Ping>(*connection_);
+	}
+
+	template <typename T>
+	auto set(std::string const &key, T const &value) {
+		return awaitCommand<ReplyString, commands::Set>(*connection_, key, value);
+	}
+
+	template <typename T>
+	auto echo(T const &message) {
+		return awaitCommand<ReplyString, commands::Echo>(*connection_, message);
+	}
+
+	auto get(std::string const &key) {
+		return awaitCommand<ReplyString, commands::Get>(*connection_, key);
+	}
+
+	auto getView(std::string const &key) {
+		return awaitCommand<ReplyView, commands::Get>(*connection_, key);
+	}
+
+	template <typename T, typename... Args>
+	auto del(T const &arg, Args const &... args) {
+		return awaitCommand<ReplyInterger, commands::Del>(*connection_, arg, args...);
+	}
+
+	AsyncConnection &connection() noexcept {
+		return *connection_;
+	}
+private:
+	std::unique_ptr<AsyncConnection> connection_;
+};
+
+}
+
+#endif
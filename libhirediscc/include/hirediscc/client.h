@@ -9,7 +9,9 @@
 #include <vector>
 #include <memory>
 
+#include <hirediscc/reply.h>
 #include <hirediscc/pipelined.h>
+#include <hirediscc/pipelinedstream.h>
 #include <hirediscc/commandargs.h>
 
 namespace hirediscc {
@@ -17,16 +19,23 @@ namespace hirediscc {
 class Connection;
 using ConnectionPtr = std::shared_ptr<Connection>;
 
+struct UnixSocket;
+
 class Client {
 public:
 	Client(std::string const &host,
 		uint16_t port,
 		std::string const &password = "");
 
+	explicit Client(UnixSocket const &socket,
+		std::string const &password = "");
+
 	explicit Client(ConnectionPtr conn);
 
 	~Client();
 
+	std::string ping();
+
 	template <typename T>
 	void set(std::string const &key, T value);
 
@@ -35,6 +44,9 @@ public:
 
 	std::string get(std::string const &key);
 
+	ReplyView getView(std::string const &key);
+
+	// Throws when the server answers KEYS with an error.
 	std::vector<std::string> keys();
 
 	template <typename T, typename... Args>
@@ -42,7 +54,13 @@ public:
 
 	void quit();
 
-	Pipelined pipelined();
+	Pipelined pipelined(bool useArena = false);
+
+	template <typename R = ReplyView>
+	PipelinedStream<R> stream(typename PipelinedStream<R>::Handler handler,
+		size_t window = PipelinedStream<R>::AutoWindow) {
+		return PipelinedStream<R>(connection_, std::move(handler), window);
+	}
 
 private:
 	ConnectionPtr connection_;
@@ -50,17 +68,17 @@ private:
 
 template <typename T>
 inline void Client::set(std::string const & key, T value) {
-	connection_->excuteCommandWithArgs<ReplyString>("SET", key, value);
+	connection_->excuteCommand<ReplyString, commands::Set>(key, value);
 }
 
 template <typename T>
 inline std::string Client::echo(T message) {
-	return connection_->excuteCommandWithArgs<ReplyString>("ECHO", message).value();
+	return connection_->excuteCommand<ReplyString, commands::Echo>(message).value();
 }
 
 template <typename T, typename... Args>
 inline void Client::del(T arg, Args const &... args) {
-	connection_->excuteCommandWithArgs<ReplyInterger>("DEL", arg, args ...);
+	connection_->excuteCommand<ReplyInterger, commands::Del>(arg, args ...);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,286 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <hirediscc/reply.h>
+#include <hirediscc/command.h>
+#include <hirediscc/encoder.h>
+#include <hirediscc/connectionpool.h>
+#include <hirediscc/pipelined.h>
+
+namespace hirediscc {
+
+// The hash slot of key as Redis Cluster computes it (keyHashSlot in
+// src/cluster.c): the CRC16 of the key, or of the part between its first {
+// and the next } when that is not empty, so that related keys can be kept in
+// one slot.
+uint16_t keySlot(std::string_view key) noexcept;
+
+namespace details {
+
+// A reply owned as it is, for callers that look at it before deciding on
+// its type.
+class RawReply {
+public:
+    explicit RawReply(redisReply *reply = nullptr) noexcept
+        : reply_(reply) {
+    }
+
+    RawReply(RawReply &&other) noexcept
+        : reply_(other.release()) {
+    }
+
+    RawReply& operator=(RawReply &&other) noexcept {
+        if (this != &other) {
+            deleteRedisReply(reply_);
+            reply_ = other.release();
+        }
+        return *this;
+    }
+
+    RawReply(RawReply const &) = delete;
+    RawReply& operator=(RawReply const &) = delete;
+
+    ~RawReply() {
+        deleteRedisReply(reply_);
+    }
+
+    redisReply *get() const noexcept {
+        return reply_;
+    }
+
+    redisReply *release() noexcept {
+        return std::exchange(reply_, nullptr);
+    }
+private:
+    redisReply *reply_;
+};
+
+// What a cluster error reply asks of the client: MOVED and ASK name the
+// node to send the command to, TRYAGAIN asks to send it again later.
+struct Redirect {
+    enum Type {
+        None,
+        Moved,
+        Ask,
+        TryAgain
+    };
+
+    Type type;
+    uint16_t slot;
+    std::string host;
+    uint16_t port;
+};
+
+Redirect parseRedirect(redisReply *reply);
+
+}
+
+class ClusterPipeline;
+
+// Commands for a Redis Cluster. The slot table is loaded with CLUSTER SLOTS
+// and every command goes straight to the node serving its key, through a
+// ConnectionPool per node. MOVED and ASK redirects are followed, and a MOVED
+// has the table reloaded in the background, so slots can migrate under a
+// running client.
+class ClusterClient {
+public:
+    enum {
+        SlotCount = 16384
+    };
+
+    struct Address {
+        std::string host;
+        uint16_t port;
+    };
+
+    struct Configuration {
+        // Nodes the slot table is loaded from; one that answers is enough.
+        std::vector<Address> seeds;
+        std::string password;
+        // Settings of the pool opened for each node; host, port and password
+        // are set per node.
+        ConnectionPool::Configuration pool;
+        // Redirects followed for a command before its error reply is
+        // returned as it is.
+        uint32_t maxRedirects = 5;
+    };
+
+    // Throws when none of the seeds answers CLUSTER SLOTS.
+    explicit ClusterClient(Configuration configuration);
+
+    ~ClusterClient();
+
+    ClusterClient(ClusterClient const &) = delete;
+    ClusterClient& operator=(ClusterClient const &) = delete;
+
+    // Sends command to the node serving key, which is its first argument.
+    template <typename R = ReplyString, typename... Args>
+    R excuteCommandWithArgs(std::string const &command, std::string const &key, Args const &... args);
+
+    template <typename R, auto const &Name, typename... Args>
+    R excuteCommand(std::string const &key, Args const &... args);
+
+    template <typename T>
+    void set(std::string const &key, T const &value) {
+        excuteCommand<ReplyString, commands::Set>(key, value);
+    }
+
+    std::string get(std::string const &key) {
+        return excuteCommand<ReplyString, commands::Get>(key).value();
+    }
+
+    ReplyView getView(std::string const &key) {
+        return excuteCommand<ReplyView, commands::Get>(key);
+    }
+
+    int64_t del(std::string const &key) {
+        return excuteCommand<ReplyInterger, commands::Del>(key).value();
+    }
+
+    // A pipeline spreading its commands over the nodes.
+    ClusterPipeline pipelined();
+
+    // Reloads the slot table from the known nodes, waiting for a reload
+    // already under way first.
+    void refresh();
+
+    // Number of nodes connected to.
+    size_t nodes() const;
+private:
+    friend class ClusterPipeline;
+
+    // Held by a command while it uses the pool, which a reload may drop.
+    using PoolPtr = std::shared_ptr<ConnectionPool>;
+
+    PoolPtr poolOf(uint16_t slot);
+    PoolPtr poolOf(std::string const &host, uint16_t port);
+    redisReply *excute(uint16_t slot, std::string const &request);
+    // Points the slot at the node named and returns its pool; the rest of
+    // the table is left to refreshSoon().
+    PoolPtr moved(details::Redirect const &redirect);
+    // Has the refresher thread reload the table; requests made while it is
+    // at it are served by one more reload.
+    void refreshSoon() noexcept;
+    void refresher();
+    bool load(Address const &address);
+
+    Configuration configuration_;
+    mutable std::shared_mutex mutex_;
+    // By "host:port"; load() drops the pools of nodes left out of the table.
+    std::unordered_map<std::string, PoolPtr> pools_;
+    std::vector<Address> nodes_;
+    std::vector<PoolPtr> slots_;
+    // Held across a reload, so that two never run at once.
+    std::mutex refreshMutex_;
+    std::mutex wakeMutex_;
+    std::condition_variable refreshWanted_;
+    bool refreshPending_;
+    bool stopped_;
+    std::thread thread_;
+};
+
+template <typename R, typename... Args>
+inline R ClusterClient::excuteCommandWithArgs(std::string const &command, std::string const &key, Args const &... args) {
+    static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+        "ReplyBuilder replies are not supported by ClusterClient");
+    std::string request;
+    CommandEncoder(request).encode(command, key, args...);
+    return R(excute(keySlot(key), request));
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline R ClusterClient::excuteCommand(std::string const &key, Args const &... args) {
+    static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+        "ReplyBuilder replies are not supported by ClusterClient");
+    std::string request;
+    CommandEncoder(request).encode<Name>(key, args...);
+    return R(excute(keySlot(key), request));
+}
+
+// Queues commands for a cluster and excutes them in one parallel round trip:
+// the commands are grouped by the node serving their key, each group is
+// written to its node's connection before any reply is read, and the replies
+// land in the handles returned by add(), in the order the commands were
+// queued. Redirected commands are sent again, as a group per node, until they
+// are answered or run out of redirects.
+class ClusterPipeline {
+public:
+    explicit ClusterPipeline(ClusterClient &client);
+
+    // Queues command for the node serving key, its first argument.
+    template <typename R = ReplyString, typename... Args>
+    PipelinedReply<R> add(std::string const &command, std::string const &key, Args const &... args);
+
+    template <typename R, auto const &Name, typename... Args>
+    PipelinedReply<R> add(std::string const &key, Args const &... args);
+
+    size_t size() const noexcept {
+        return commands_.size();
+    }
+
+    // Throws the first connection error once every node has been served;
+    // the replies lost with that connection rethrow it too.
+    void excute();
+private:
+    struct Command {
+        size_t offset;
+        size_t size;
+        uint16_t slot;
+        std::shared_ptr<details::PipelinedSlot> reply;
+        void (*resolve)(details::PipelinedSlot &reply, redisReply *value);
+    };
+
+    template <typename R>
+    static void resolveAs(details::PipelinedSlot &reply, redisReply *value) {
+        static_cast<details::TypedPipelinedSlot<R>&>(reply).resolve(value);
+    }
+
+    template <typename R>
+    PipelinedReply<R> push(std::string const &key, size_t offset);
+
+    ClusterClient &client_;
+    std::string requests_;
+    std::vector<Command> commands_;
+};
+
+template <typename R, typename... Args>
+inline PipelinedReply<R> ClusterPipeline::add(std::string const &command, std::string const &key, Args const &... args) {
+    auto offset = requests_.size();
+    CommandEncoder(requests_).encode(command, key, args...);
+    return push<R>(key, offset);
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline PipelinedReply<R> ClusterPipeline::add(std::string const &key, Args const &... args) {
+    auto offset = requests_.size();
+    CommandEncoder(requests_).encode<Name>(key, args...);
+    return push<R>(key, offset);
+}
+
+template <typename R>
+inline PipelinedReply<R> ClusterPipeline::push(std::string const &key, size_t offset) {
+    static_assert(!std::is_base_of<ReplyBuilder, R>::value,
+        "ReplyBuilder replies are not supported by ClusterPipeline");
+    auto reply = std::make_shared<details::TypedPipelinedSlot<R>>();
+    commands_.push_back(Command { offset, requests_.size() - offset, keySlot(key), reply, &resolveAs<R> });
+    return PipelinedReply<R>(std::move(reply));
+}
+
+}
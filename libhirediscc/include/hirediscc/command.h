@@ -0,0 +1,93 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+
+namespace hirediscc {
+
+// Name of a command known at compile time. Instances must have static storage
+// duration (see hirediscc::commands) so they can be used as template arguments.
+template <size_t N>
+struct CommandName {
+    constexpr CommandName(char const (&name)[N])
+        : value{} {
+        for (size_t i = 0; i < N; ++i)
+            value[i] = name[i];
+    }
+
+    constexpr size_t size() const {
+        return N - 1;
+    }
+
+    char value[N];
+};
+
+// The "*<arity>\r\n$<length>\r\n<name>\r\n" prefix of a RESP request.
+template <size_t N>
+struct CommandPrefix {
+    char data[N + 48];
+    size_t size;
+};
+
+template <size_t N>
+constexpr CommandPrefix<N> makeCommandPrefix(CommandName<N> const &name, size_t arity) {
+    CommandPrefix<N> prefix{};
+    size_t pos = 0;
+
+    auto put = [&](char c) {
+        prefix.data[pos++] = c;
+    };
+
+    auto putNumber = [&](size_t number) {
+        char digits[20] = {};
+        size_t count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + number % 10);
+            number /= 10;
+        } while (number != 0);
+        while (count != 0)
+            put(digits[--count]);
+    };
+
+    put('*');
+    putNumber(arity);
+    put('\r');
+    put('\n');
+    put('$');
+    putNumber(name.size());
+    put('\r');
+    put('\n');
+    for (size_t i = 0; i < name.size(); ++i)
+        put(name.value[i]);
+    put('\r');
+    put('\n');
+
+    prefix.size = pos;
+    return prefix;
+}
+
+// Prefix for the command Name called with Arity arguments (name included),
+// generated once at compile time.
+template <auto const &Name, size_t Arity>
+inline constexpr auto commandPrefix = makeCommandPrefix(Name, Arity);
+
+namespace commands {
+
+inline constexpr CommandName Asking{ "ASKING" };
+inline constexpr CommandName Auth{ "AUTH" };
+inline constexpr CommandName Cluster{ "CLUSTER" };
+inline constexpr CommandName Del{ "DEL" };
+inline constexpr CommandName Echo{ "ECHO" };
+inline constexpr CommandName Get{ "GET" };
+inline constexpr CommandName Keys{ "KEYS" };
+inline constexpr CommandName Ping{ "PING" };
+inline constexpr CommandName Quit{ "QUIT" };
+inline constexpr CommandName Set{ "SET" };
+
+}
+
+}
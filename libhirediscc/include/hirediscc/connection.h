@@ -5,13 +5,37 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <type_traits>
+#include <string>
+#include <vector>
 
+#include <hirediscc/arena.h>
 #include <hirediscc/details.h>
 #include <hirediscc/commandargs.h>
+#include <hirediscc/encoder.h>
+#include <hirediscc/replybuilder.h>
 
 namespace hirediscc {
 
+// How a connection moves its bytes. IoUring hands a request and the read of
+// its reply to the kernel in one io_uring_enter; it needs Linux 5.11 or
+// later and a build with HIREDISCC_WITH_IO_URING, and falls back to Socket
+// otherwise.
+enum class Transport {
+    Socket,
+    IoUring
+};
+
+// A unix domain socket path to connect over instead of TCP, for a server on
+// the same host. Not supported on Windows.
+struct UnixSocket {
+    std::string path;
+};
+
 class Context {
 public:
     explicit Context(redisContext *context);
@@ -25,17 +49,105 @@ public:
 
     void appendCommandWithArgs(CommandArgs const &args);
 
-	void appendCommand(CommandArgs const &args);
+    template <typename... Args>
+    void encodeCommand(Args const &... args) {
+        CommandEncoder(obuf_).encode(args...);
+    }
+
+    template <auto const &Name, typename... Args>
+    void encodeCommand(Args const &... args) {
+        CommandEncoder(obuf_).encode<Name>(args...);
+    }
 
     void enableKeepAlive();
 
+    void flush();
+
+    // Flushes before a reply is read; with the IoUring transport the first
+    // read of the reply goes along.
+    void send();
+
+    // Returns the transport in use, which is Socket when io_uring is
+    // unavailable.
+    Transport setTransport(Transport transport);
+
+    Transport transport() const noexcept {
+        return transport_;
+    }
+
+    // How long, in seconds, pump() and the IoUring transport wait for the
+    // socket; set by Connection on connect. None by default.
+    void setTimeout(int timeout);
+
+    // Sends already encoded requests after anything still buffered.
+    void write(char const *data, size_t size);
+
     template <typename T>
     T excute() {
-        T reply(details::excute(context_));
-        return std::move(reply);
+        send();
+        if constexpr (std::is_base_of<ReplyBuilder, T>::value) {
+            T reply;
+            details::excute(context_, reply);
+            return reply;
+        } else {
+            T reply(details::excute(context_));
+            return reply;
+        }
+    }
+
+    // The reply is built in arena and stays valid until the arena is reset.
+    // Replies that copy their payload out do not use the arena.
+    template <typename T>
+    T excute(ReplyArena &arena) {
+        if constexpr (T::CopiesPayload) {
+            return excute<T>();
+        } else {
+            send();
+            T reply(details::excute(context_, arena));
+            reply.release();
+            return reply;
+        }
+    }
+
+    void excute(ReplyBuilder &builder);
+
+    bool isClean() const noexcept {
+        return obuf_.empty() && details::isClean(context_);
+    }
+
+    // Reads once from the socket into the reply buffer.
+    void read();
+
+    redisContext *handle() const noexcept {
+        return context_;
+    }
+
+    // One round of non-blocking I/O for streaming: waits until the socket can
+    // make progress, sends what it accepts from data and reads what has
+    // arrived. Returns the number of bytes of data sent; read, if given,
+    // receives the number of bytes read. Throws Exception(Exception::Timeout)
+    // when nothing happens within the connection's timeout.
+    size_t pump(char const *data, size_t size, bool wantRead, size_t *read = nullptr);
+
+    // As pump(), but waits without a timeout and also returns, having drained
+    // it, once wakeFd (the read end of a pipe) is readable.
+    size_t pump(char const *data, size_t size, bool wantRead, int wakeFd);
+
+    // The next reply if it has been read completely, without blocking.
+    template <typename T>
+    std::optional<T> poll() {
+        static_assert(!std::is_base_of<ReplyBuilder, T>::value,
+            "ReplyBuilder replies are not supported when streaming");
+        auto reply = details::pollReply(context_);
+        if (reply == nullptr)
+            return std::nullopt;
+        return std::optional<T>(std::in_place, reply);
     }
 private:
     redisContext *context_;
+    std::string obuf_;
+    Transport transport_;
+    int timeoutMs_;
 };
 
 class Connection {
@@ -55,17 +167,43 @@ public:
         uint16_t port,
         int timeout = DefaultTimeout);
 
+    void connect(UnixSocket const &socket, int timeout = DefaultTimeout);
+
+    // Starts connecting without waiting; once the connection is writable
+    // (see waitReady), finishConnect() completes it.
+    void connectNonBlock(std::string const &host, uint16_t port);
+
+    void connectNonBlock(UnixSocket const &socket);
+
+    void finishConnect(int timeout = DefaultTimeout);
+
     void close();
 
+    // Switches the connection's blocking round trips to transport; returns
+    // the transport in effect.
+    Transport setTransport(Transport transport) {
+        return context_->setTransport(transport);
+    }
+
+    // Connected, without an error and with no command or reply left half
+    // way, so the connection can be handed to someone else as it is.
+    bool isHealthy() const noexcept {
+        return context_ != nullptr && context_->isClean();
+    }
+
     std::string ping();
 
     std::string setAuth(std::string const &password);
 
     template <typename R, typename T, typename... Args>
-    R excuteCommandWithArgs(T arg, Args const &... args) {
-        CommandArgs commandArgs;
-        append(commandArgs, arg, args...);
-        context_->appendCommandWithArgs(commandArgs);
+    R excuteCommandWithArgs(T const &arg, Args const &... args) {
+        context_->encodeCommand(arg, args...);
+        return context_->excute<R>();
+    }
+
+    template <typename R, auto const &Name, typename... Args>
+    R excuteCommand(Args const &... args) {
+        context_->encodeCommand<Name>(args...);
         return context_->excute<R>();
     }
 
@@ -80,15 +218,62 @@ public:
         append(commandArgs, args ...);
     }
 
+    template <typename T, typename... Args>
+    void excuteCommandWithBuilder(ReplyBuilder &builder, T const &arg, Args const &... args) {
+        context_->encodeCommand(arg, args...);
+        context_->excute(builder);
+    }
+
 	template <typename R>
 	R excuteOnce() {
 		return context_->excute<R>();
 	}
 
-	void appendCommand(CommandArgs const &args);
+	template <typename R>
+	R excuteOnce(ReplyArena &arena) {
+		return context_->excute<R>(arena);
+	}
+
+    void write(std::string const &requests);
+
+    size_t pump(char const *data, size_t size, bool wantRead, size_t *read = nullptr) {
+        return context_->pump(data, size, wantRead, read);
+    }
+
+    size_t pump(char const *data, size_t size, bool wantRead, int wakeFd) {
+        return context_->pump(data, size, wantRead, wakeFd);
+    }
+
+    void read() {
+        context_->read();
+    }
+
+    // Waits up to timeout for any of connections to have something to read;
+    // readable[i] is set for each one that does. Returns how many are set.
+    static size_t waitReadable(std::vector<Connection*> const &connections,
+        std::chrono::milliseconds timeout,
+        std::vector<char> &readable) {
+        return waitReady(connections, {}, timeout, readable);
+    }
+
+    // As waitReadable, but waits for the connections flagged in wantWrite to
+    // become writable, i.e. connected when started with connectNonBlock.
+    static size_t waitReady(std::vector<Connection*> const &connections,
+        std::vector<char> const &wantWrite,
+        std::chrono::milliseconds timeout,
+        std::vector<char> &ready);
+
+    template <typename R>
+    std::optional<R> tryExcuteOnce() {
+        return context_->poll<R>();
+    }
 
 private:
+    void open(redisContext *context);
+
     std::unique_ptr<Context> context_;
+    // Connected over a unix domain socket, which has no TCP keep-alive.
+    bool local_;
 };
 
 }
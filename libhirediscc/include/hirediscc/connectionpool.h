@@ -7,10 +7,16 @@
 
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <hirediscc/mpmc_bounded_queue.h>
 
@@ -23,6 +29,19 @@ class Context;
 
 class ConnectionPool {
 public:
+    // A sizing decision of the maintenance thread.
+    struct ResizeEvent {
+        enum Reason {
+            Grow,
+            Shrink
+        };
+
+        Reason reason;
+        uint32_t from;
+        uint32_t to;
+        uint32_t idle;
+    };
+
     struct Configuration {
         uint32_t initCapacity;
         uint32_t maxCapacity;
@@ -32,6 +51,20 @@ public:
         std::string host;
         uint16_t port;
         std::string password;
+        // Connections that must be up before the constructor returns; the
+        // rest of initCapacity keep connecting in the background. 0 waits
+        // for all of them.
+        uint32_t readyThreshold;
+        // Number of idle free lists. With more than one, each thread uses the
+        // list of the core it runs on and steals from its neighbours when
+        // that one is empty, so borrow and return stay core-local; e.g. set
+        // it to std::thread::hardware_concurrency(). 0 means a single list.
+        uint32_t shards;
+        // Called on the maintenance thread after the pool grows or shrinks.
+        std::function<void(ResizeEvent const &event)> onResize;
+        // When set, connections go to this unix domain socket path and host
+        // and port are ignored.
+        std::string unixSocket;
     };
 
     class ConnectionPtrDeleter {
@@ -43,6 +76,11 @@ public:
         explicit ConnectionPtrDeleter(std::weak_ptr<ConnectionPool*> pool)
             : pool_(pool) {}
 
+        // The connection is deleted instead of returned once released.
+        void detach() noexcept {
+            pool_.reset();
+        }
+
         void operator()(Connection* p) {
             auto pool = pool_.lock();
             if (!pool) {
@@ -60,23 +98,151 @@ public:
 
     using PoolablesConnectionPtr = std::unique_ptr<Connection, ConnectionPtrDeleter>;
 
+    // Outcome of the maintenance thread's health checks. The per-sweep
+    // fields describe the most recent sweep.
+    struct HealthStats {
+        uint64_t sweeps;
+        uint64_t totalEvicted;
+        uint32_t checked;
+        uint32_t healthy;
+        uint32_t evicted;
+        uint32_t replaced;
+        std::chrono::microseconds sweepTime;
+    };
+
+    struct SizingStats {
+        uint32_t capacity;
+        uint32_t idle;
+        uint64_t grown;
+        uint64_t shrunk;
+    };
+
+    // Opens initCapacity connections concurrently and returns once
+    // readyThreshold of them are up; throws if that many can't be opened.
     explicit ConnectionPool(Configuration configuration);
 
     ~ConnectionPool();
 
+    // Blocks until a connection is idle. Spins briefly, then parks the
+    // caller until a connection is handed back. A connection that has been
+    // idle for longer than maxIdleTimeout is pinged before it is returned.
     ConnectionPtr borrowConnection();
 
+    // As above, but throws Exception(Exception::PoolTimeout) when no
+    // connection became idle within timeout.
+    ConnectionPtr borrowConnection(std::chrono::milliseconds timeout);
+
+    // A healthy connection is idle again at once; a broken one is left to
+    // the maintenance thread to reconnect.
     void returnConnection(ConnectionPtr conn);
 
+    // Opt-in sticky mode for thread-per-core servers: the calling thread
+    // keeps one connection cached in a thread-local slot of this pool, so
+    // the common borrow is a load and an epoch compare. The connection goes
+    // back to the pool when the thread exits, and on the thread's next call
+    // after the pool grew or shrank; it must not be used once returned. It
+    // is not checked on each call: after an Exception from it, call
+    // releaseThreadConnection() to have it repaired and get a fresh one.
+    Connection &threadConnection();
+
+    // Gives the calling thread's sticky connection back early.
+    void releaseThreadConnection();
+
+    HealthStats healthStats() const;
+
+    SizingStats sizingStats() const;
+
 private:
+    using Clock = std::chrono::steady_clock;
+
+    struct IdleConnection {
+        ConnectionPtr connection;
+        Clock::time_point since;
+    };
+
+    // One idle free list with its share of maxIdle, on its own cache lines.
+    // It is a stack: borrowers get the connection returned last, so the warm
+    // ones stay in use and the ones at the bottom age out.
+    struct alignas(64) Shard {
+        Shard(size_t capacity, uint32_t limit)
+            : count(0)
+            , limit(limit) {
+            idle.reserve(capacity);
+        }
+
+        std::mutex mutex;
+        std::vector<IdleConnection> idle;
+        std::atomic<uint32_t> count;
+        uint32_t const limit;
+    };
+
     PoolablesConnectionPtr allocate();
 
+    Connection &stickConnection();
+
+    ConnectionPtr borrowConnection(std::optional<Clock::time_point> deadline);
+
+    uint32_t homeShard() const noexcept;
+
+    uint32_t idleCount() const noexcept;
+
+    bool tryBorrow(IdleConnection &idle);
+
+    bool waitConnection(IdleConnection &idle, std::optional<Clock::time_point> deadline);
+
+    bool validate(IdleConnection const &idle);
+
+    void makeIdle(ConnectionPtr const &conn, Clock::time_point since, uint32_t shard);
+
+    // Puts a connection the maintenance thread has checked back in service.
+    void release(ConnectionPtr conn);
+
+    void wakeBorrower();
+
+    void warmUp();
+
+    void open(uint32_t count);
+
+    uint32_t connect(std::vector<ConnectionPtr> connections);
+
+    void grow();
+
+    void repair(ConnectionPtr &conn, bool reportShrink);
+
+    void retire(ConnectionPtr &conn);
+
+    void report(ResizeEvent::Reason reason, uint32_t from, uint32_t count);
+
+    void maintain();
+
+    void sweep();
+
     Configuration configuration_;
-    volatile bool stopped_;
-    std::atomic<uint32_t> idleCount_;
+    uint64_t const id_;
+    // Index of this pool's sticky connection in every thread's slots.
+    uint32_t const slot_;
+    std::atomic<bool> stopped_;
+    std::atomic<uint32_t> capacity_;
+    // Bumped on every resize; sticky connections taken before go back.
+    std::atomic<uint64_t> epoch_;
     std::shared_ptr<ConnectionPool*> this_;
     mpmc_bounded_queue<ConnectionPtr> poolConn_;
-    mpmc_bounded_queue<ConnectionPtr> aliveConn_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint32_t> waiters_;
+    uint32_t nextShard_;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::condition_variable warmedUp_;
+    std::condition_variable maintain_;
+    bool growRequested_;
+    bool warming_;
+    int warmUpError_;
+    // Connections brought up so far, idle or not; warm-up waits on it.
+    uint32_t opened_;
+    mutable std::mutex statsMutex_;
+    HealthStats stats_;
+    uint64_t grown_;
+    uint64_t shrunk_;
     std::thread thread_;
 };
 
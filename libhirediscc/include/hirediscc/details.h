@@ -8,20 +8,37 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 
 struct redisReply;
 struct redisContext;
 
 namespace hirediscc {
 
+class ReplyArena;
+class ReplyBuilder;
+
 namespace details {
 
 void deleteRedisReply(redisReply *reply);
 int32_t getRedisReplyType(redisReply *reply);
 void deserializeRedisReply(redisReply *reply, std::string &result);
+void deserializeRedisReply(redisReply *reply, std::string_view &result);
 void deserializeRedisReply(redisReply *reply, int64_t &result);
 void deserializeRedisReply(redisReply *reply, std::vector<redisReply*> &result);
+void writeBuffer(redisContext *context, char const *data, size_t size);
+size_t pumpSocket(redisContext *context, char const *data, size_t size, bool wantRead, size_t *read, int timeoutMs, int wakeFd = -1);
+redisReply *pollReply(redisContext *context);
+void readSocket(redisContext *context);
+size_t pollSockets(std::vector<redisContext*> const &contexts, std::vector<char> const &wantWrite, int timeoutMs, std::vector<char> &ready);
+void finishConnect(redisContext *context, int timeout);
+bool exchangeIoUring(redisContext *context, char const *data, size_t size, int timeoutMs);
+bool isClean(redisContext *context);
+void makeRepliesDetachable(redisContext *context);
+void detachReply(redisReply *reply);
 redisReply *excute(redisContext* context);
+void excute(redisContext *context, ReplyBuilder &builder);
+redisReply *excute(redisContext *context, ReplyArena &arena);
 
 }
 
@@ -0,0 +1,97 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <hirediscc/command.h>
+#include <hirediscc/commandargs.h>
+
+namespace hirediscc {
+
+// Serializes command arguments as a RESP multi-bulk request straight into an
+// output buffer. Numbers are formatted on the stack with to_chars, so once the
+// buffer has grown to its working size encoding a command does not allocate.
+class CommandEncoder {
+public:
+    explicit CommandEncoder(std::string &buffer)
+        : buffer_(buffer) {
+    }
+
+    template <typename... Args>
+    void encode(Args const &... args) {
+        appendHeader('*', (count(args) + ...));
+        (append(args), ...);
+    }
+
+    // Same as encode("NAME", args...) for a command whose name and arity are
+    // fixed, with the request prefix taken from commandPrefix.
+    template <auto const &Name, typename... Args>
+    void encode(Args const &... args) {
+        static_assert(!(std::is_same<Args, CommandArgs>::value || ...),
+            "CommandArgs has a dynamic arity");
+        auto const &prefix = commandPrefix<Name, sizeof...(Args) + 1>;
+        buffer_.append(prefix.data, prefix.size);
+        (append(args), ...);
+    }
+
+    void append(std::string_view arg) {
+        appendHeader('$', arg.size());
+        buffer_.append(arg.data(), arg.size());
+        buffer_.append("\r\n", 2);
+    }
+
+    void append(std::string const &arg) {
+        append(std::string_view(arg));
+    }
+
+    void append(char const *arg) {
+        append(std::string_view(arg, std::strlen(arg)));
+    }
+
+    void append(bool arg) {
+        append(std::string_view(arg ? "1" : "0", 1));
+    }
+
+    template <typename T>
+    std::enable_if_t<std::is_arithmetic<T>::value> append(T arg) {
+        char buffer[32];
+        auto result = std::to_chars(std::begin(buffer), std::end(buffer), arg);
+        append(std::string_view(buffer, result.ptr - buffer));
+    }
+
+    void append(CommandArgs const &args) {
+        for (auto const &arg : args)
+            append(std::string_view(arg));
+    }
+
+    template <typename T>
+    static size_t count(T const &) {
+        return 1;
+    }
+
+    static size_t count(CommandArgs const &args) {
+        return args.count();
+    }
+
+private:
+    void appendHeader(char prefix, size_t length) {
+        char header[24];
+        header[0] = prefix;
+        auto result = std::to_chars(header + 1, header + sizeof(header) - 2, length);
+        *result.ptr++ = '\r';
+        *result.ptr++ = '\n';
+        buffer_.append(header, result.ptr - header);
+    }
+
+    std::string &buffer_;
+};
+
+}
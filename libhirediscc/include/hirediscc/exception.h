@@ -11,11 +11,21 @@ namespace hirediscc {
 
 class Exception : public std::exception {
 public:
+    // Errors raised by libhirediscc itself, numbered after hiredis' REDIS_ERR_*.
+    enum {
+        PoolTimeout = 100,
+        Timeout = 101
+    };
+
     Exception() = default;
 
     explicit Exception(int error);
 
-    virtual char const * what() const override;
+    virtual char const * what() const noexcept override;
+
+    int error() const noexcept {
+        return error_;
+    }
 private:
     int error_;
 };
@@ -5,9 +5,14 @@
 
 #pragma once
 
+#include <hirediscc/asyncclient.h>
+#include <hirediscc/awaitable.h>
 #include <hirediscc/client.h>
+#include <hirediscc/cluster.h>
 #include <hirediscc/exception.h>
 #include <hirediscc/reply.h>
 #include <hirediscc/connection.h>
 #include <hirediscc/connectionpool.h>
+#include <hirediscc/multiplexed.h>
+#include <hirediscc/reactor.h>
 
@@ -0,0 +1,86 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace hirediscc {
+
+namespace details {
+
+// A minimal io_uring on the raw system calls, for the IoUring transport.
+// Operations are only queued until submit(), so everything queued in between
+// goes to the kernel with a single io_uring_enter. Not thread-safe.
+class IoUring {
+public:
+	struct Completion {
+		uint64_t data;
+		int32_t result;
+	};
+
+	// nullptr when io_uring is unavailable: not Linux, built without it, an
+	// older kernel or out of locked memory.
+	static std::unique_ptr<IoUring> create(unsigned entries);
+
+	// The calling thread's own ring, created on first use; nullptr when
+	// unavailable.
+	static IoUring *forThread();
+
+	static bool isAvailable();
+
+	IoUring(IoUring const &) = delete;
+	IoUring& operator=(IoUring const &) = delete;
+
+	~IoUring();
+
+	// Free entries in the submission queue.
+	unsigned space() const;
+
+	// Each returns false when the submission queue is full. A linked send
+	// holds back the operation queued next until it has sent everything;
+	// that one fails with -ECANCELED if it does not.
+	bool send(int fd, void const *data, size_t size, uint64_t userData, bool link = false);
+	bool recv(int fd, void *data, size_t size, uint64_t userData);
+	bool read(int fd, void *data, size_t size, uint64_t userData);
+	bool pollOut(int fd, uint64_t userData);
+	bool cancel(uint64_t target, uint64_t userData);
+
+	// Submits what is queued and waits up to timeoutMs (-1 for ever) for at
+	// least waitFor completions. Returns false when it timed out.
+	bool submit(unsigned waitFor = 0, int timeoutMs = -1);
+
+	bool pop(Completion &completion);
+private:
+	IoUring();
+
+	io_uring_sqe *next();
+
+	int fd_;
+	void *ring_;
+	size_t ringSize_;
+	io_uring_sqe *sqes_;
+	size_t sqesSize_;
+	unsigned *sqHead_;
+	unsigned *sqTail_;
+	unsigned *sqArray_;
+	unsigned sqMask_;
+	unsigned sqEntries_;
+	unsigned *cqHead_;
+	unsigned *cqTail_;
+	unsigned cqMask_;
+	io_uring_cqe *cqes_;
+	unsigned tail_;
+	unsigned queued_;
+};
+
+}
+
+}
@@ -29,12 +29,97 @@ should not be interpreted as representing official policies, either expressed or
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 #include <atomic>
 
-template<typename T>
-class mpmc_bounded_queue {
+// Lets threads sleep until a condition published by another thread may have
+// changed, without making the fast path take a lock: a waiter announces
+// itself with prepare_wait(), re-checks its condition and then either
+// cancel_wait()s or commit_wait()s; notify() only takes the lock when someone
+// is waiting.
+class eventcount {
+public:
+    using key_type = uint32_t;
+
+    eventcount()
+        : state_(0) {
+    }
+
+    eventcount(eventcount const &) = delete;
+    eventcount& operator=(eventcount const &) = delete;
+
+    key_type prepare_wait() {
+        return static_cast<key_type>(state_.fetch_add(1, std::memory_order_seq_cst) >> 32);
+    }
+
+    void cancel_wait() {
+        state_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void commit_wait(key_type key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() {
+            return epoch() != key;
+        });
+        state_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Returns false if deadline passed without a notify().
+    template <typename Clock, typename Duration>
+    bool commit_wait_until(key_type key, std::chrono::time_point<Clock, Duration> const &deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto notified = cv_.wait_until(lock, deadline, [&]() {
+            return epoch() != key;
+        });
+        state_.fetch_sub(1, std::memory_order_seq_cst);
+        return notified;
+    }
+
+    void notify() {
+        // Orders the caller's publish before the waiter check; pairs with
+        // the fetch_add in prepare_wait().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ((state_.load(std::memory_order_relaxed) & waiters_mask) == 0)
+            return;
+        state_.fetch_add(epoch_one, std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+private:
+    static uint64_t const waiters_mask = 0xffffffffu;
+    static uint64_t const epoch_one = uint64_t(1) << 32;
+
+    key_type epoch() const {
+        return static_cast<key_type>(state_.load(std::memory_order_seq_cst) >> 32);
+    }
+
+    // Epoch in the high half, number of waiters in the low half.
+    std::atomic<uint64_t> state_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+// Holds the eventcount only for blocking queues, so non-blocking ones pay
+// nothing for it.
+template<bool blocking>
+struct mpmc_queue_waiters {
+};
+
+template<>
+struct mpmc_queue_waiters<true> {
+    eventcount not_empty_;
+};
+
+// With blocking set, enqueues wake consumers parked in the wait_dequeue*
+// calls; otherwise enqueues skip the waiter check altogether.
+template<typename T, bool blocking = false>
+class mpmc_bounded_queue : private mpmc_queue_waiters<blocking> {
 public:
     using item_type = T;
 
@@ -43,7 +128,7 @@ public:
         buffer_mask_(buffer_size - 1) {
         //queue size must be power of two
         if (!((buffer_size >= 2) && ((buffer_size & (buffer_size - 1)) == 0)))
-            throw std::exception("async logger queue size must be power of two");
+            throw std::invalid_argument("mpmc_bounded_queue size must be power of two");
 
         for (size_t i = 0; i != buffer_size; i += 1)
             buffer_[i].sequence_.store(i, std::memory_order_relaxed);
@@ -75,9 +160,44 @@ public:
         }
         cell->data_ = data;
         cell->sequence_.store(pos + 1, std::memory_order_release);
+        if constexpr (blocking)
+            this->not_empty_.notify();
         return true;
     }
 
+    // Enqueues up to count items from data, claiming their slots with a
+    // single CAS. Returns how many were enqueued, 0 if the queue is full.
+    size_t try_enqueue_bulk(T* data, size_t count) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t claimed;
+        for (;;) {
+            claimed = 0;
+            while (claimed < count && claimed <= buffer_mask_) {
+                size_t seq = buffer_[(pos + claimed) & buffer_mask_].sequence_.load(std::memory_order_acquire);
+                if (seq != pos + claimed)
+                    break;
+                ++claimed;
+            }
+            if (claimed == 0) {
+                size_t seq = buffer_[pos & buffer_mask_].sequence_.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)pos < 0)
+                    return 0;
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i != claimed; ++i) {
+            cell_t* cell = &buffer_[(pos + i) & buffer_mask_];
+            cell->data_ = data[i];
+            cell->sequence_.store(pos + i + 1, std::memory_order_release);
+        }
+        if constexpr (blocking)
+            this->not_empty_.notify();
+        return claimed;
+    }
+
     bool try_dequeue(T& data) {
         cell_t* cell;
         size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
@@ -99,6 +219,81 @@ public:
         return true;
     }
 
+    // Dequeues up to count items into data, claiming their slots with a
+    // single CAS. Returns how many were dequeued, 0 if the queue is empty.
+    size_t try_dequeue_bulk(T* data, size_t count) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t claimed;
+        for (;;) {
+            claimed = 0;
+            while (claimed < count && claimed <= buffer_mask_) {
+                size_t seq = buffer_[(pos + claimed) & buffer_mask_].sequence_.load(std::memory_order_acquire);
+                if (seq != pos + claimed + 1)
+                    break;
+                ++claimed;
+            }
+            if (claimed == 0) {
+                size_t seq = buffer_[pos & buffer_mask_].sequence_.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+                    return 0;
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i != claimed; ++i) {
+            cell_t* cell = &buffer_[(pos + i) & buffer_mask_];
+            data[i] = std::move(cell->data_);
+            cell->sequence_.store(pos + i + buffer_mask_ + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    // Blocks until an item can be dequeued.
+    void wait_dequeue(T& data) {
+        static_assert(blocking, "wait_dequeue needs a blocking mpmc_bounded_queue");
+        while (!try_dequeue(data)) {
+            auto key = this->not_empty_.prepare_wait();
+            if (try_dequeue(data)) {
+                this->not_empty_.cancel_wait();
+                return;
+            }
+            this->not_empty_.commit_wait(key);
+        }
+    }
+
+    // Returns false if nothing could be dequeued before deadline.
+    template <typename Clock, typename Duration>
+    bool wait_dequeue_until(T& data, std::chrono::time_point<Clock, Duration> const &deadline) {
+        static_assert(blocking, "wait_dequeue_until needs a blocking mpmc_bounded_queue");
+        while (!try_dequeue(data)) {
+            auto key = this->not_empty_.prepare_wait();
+            if (try_dequeue(data)) {
+                this->not_empty_.cancel_wait();
+                return true;
+            }
+            if (!this->not_empty_.commit_wait_until(key, deadline))
+                return try_dequeue(data);
+        }
+        return true;
+    }
+
+    // Blocks until at least one item is available, then dequeues up to count.
+    size_t wait_dequeue_bulk(T* data, size_t count) {
+        static_assert(blocking, "wait_dequeue_bulk needs a blocking mpmc_bounded_queue");
+        for (;;) {
+            if (auto n = try_dequeue_bulk(data, count))
+                return n;
+            auto key = this->not_empty_.prepare_wait();
+            if (auto n = try_dequeue_bulk(data, count)) {
+                this->not_empty_.cancel_wait();
+                return n;
+            }
+            this->not_empty_.commit_wait(key);
+        }
+    }
+
 private:
     struct cell_t {
         std::atomic<size_t>   sequence_;
@@ -0,0 +1,179 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <hirediscc/reply.h>
+#include <hirediscc/connection.h>
+
+namespace hirediscc {
+
+class Connection;
+using ConnectionPtr = std::shared_ptr<Connection>;
+
+namespace details {
+
+class MultiplexedWaiter {
+public:
+	virtual ~MultiplexedWaiter() = default;
+
+	// Completes the waiter if its reply is already buffered.
+	virtual bool tryResolve(Connection &connection) = 0;
+
+	virtual void fail(std::exception_ptr error) = 0;
+};
+
+template <typename R>
+class TypedMultiplexedWaiter : public MultiplexedWaiter {
+public:
+	bool tryResolve(Connection &connection) override {
+		auto reply = connection.tryExcuteOnce<R>();
+		if (!reply)
+			return false;
+		promise_.set_value(std::move(*reply));
+		return true;
+	}
+
+	void fail(std::exception_ptr error) override {
+		promise_.set_exception(error);
+	}
+
+	std::future<R> future() {
+		return promise_.get_future();
+	}
+private:
+	std::promise<R> promise_;
+};
+
+}
+
+// One connection shared by any number of threads. Commands issued
+// concurrently are queued, coalesced into a single write by the I/O thread
+// and their replies handed back to the callers in order (auto-pipelining),
+// so a few sockets carry the load of many blocking callers. Commands queued
+// while the I/O thread waits for replies wake it, so they are written at once
+// rather than behind the batch in flight.
+//
+// A slow reply (e.g. to BLPOP) holds up only the callers of the commands
+// behind it; the connection's timeout applies once the connection is being
+// destroyed. A connection error fails every outstanding command and all later
+// ones; create a new MultiplexedConnection to reconnect.
+class MultiplexedConnection {
+public:
+	struct Stats {
+		uint64_t commands;
+		uint64_t writes;
+	};
+
+	MultiplexedConnection(std::string const &host,
+		uint16_t port,
+		std::string const &password = "",
+		uint32_t timeout = Connection::DefaultTimeout);
+
+	explicit MultiplexedConnection(ConnectionPtr conn);
+
+	MultiplexedConnection(MultiplexedConnection const &) = delete;
+	MultiplexedConnection& operator=(MultiplexedConnection const &) = delete;
+
+	// Waits for the commands already queued to be answered or to time out.
+	~MultiplexedConnection();
+
+	template <typename R = ReplyString, typename T, typename... Args>
+	std::future<R> send(T const &arg, Args const &... args);
+
+	template <typename R, auto const &Name, typename... Args>
+	std::future<R> send(Args const &... args);
+
+	template <typename R = ReplyString, typename T, typename... Args>
+	R excute(T const &arg, Args const &... args) {
+		return send<R>(arg, args...).get();
+	}
+
+	template <typename R, auto const &Name, typename... Args>
+	R excute(Args const &... args) {
+		return send<R, Name>(args...).get();
+	}
+
+	// Number of commands sent and of the socket writes, each a send call
+	// that went through, that carried them.
+	Stats stats() const noexcept {
+		return Stats { commands_.load(), writes_.load() };
+	}
+private:
+	template <typename R, typename Encode>
+	std::future<R> enqueue(Encode encode);
+
+	void start();
+	void run();
+	// Ends the I/O thread's wait for the socket.
+	void wake();
+	void fail(std::exception_ptr error, std::deque<std::unique_ptr<details::MultiplexedWaiter>> &inFlight);
+
+	ConnectionPtr connection_;
+	std::mutex mutex_;
+	std::condition_variable wakeup_;
+	std::string pending_;
+	std::deque<std::unique_ptr<details::MultiplexedWaiter>> waiters_;
+	bool stopped_;
+	// The I/O thread is waiting for the socket, not on wakeup_.
+	bool polling_;
+	int wakePipe_[2];
+	std::exception_ptr error_;
+	std::atomic<uint64_t> commands_;
+	std::atomic<uint64_t> writes_;
+	std::thread thread_;
+};
+
+template <typename R, typename Encode>
+inline std::future<R> MultiplexedConnection::enqueue(Encode encode) {
+	auto waiter = std::make_unique<details::TypedMultiplexedWaiter<R>>();
+	auto future = waiter->future();
+	bool poll = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (error_) {
+			waiter->fail(error_);
+			return future;
+		}
+		auto first = pending_.empty();
+		encode(pending_);
+		waiters_.push_back(std::move(waiter));
+		if (first && polling_)
+			poll = true;
+		else if (first)
+			wakeup_.notify_one();
+	}
+	if (poll)
+		wake();
+	++commands_;
+	return future;
+}
+
+template <typename R, typename T, typename... Args>
+inline std::future<R> MultiplexedConnection::send(T const &arg, Args const &... args) {
+	return enqueue<R>([&](std::string &buffer) {
+		CommandEncoder(buffer).encode(arg, args...);
+	});
+}
+
+template <typename R, auto const &Name, typename... Args>
+inline std::future<R> MultiplexedConnection::send(Args const &... args) {
+	return enqueue<R>([&](std::string &buffer) {
+		CommandEncoder(buffer).encode<Name>(args...);
+	});
+}
+
+}
@@ -5,8 +5,14 @@
 
 #pragma once
 
+#include <cassert>
+#include <exception>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include <hirediscc/reply.h>
 #include <hirediscc/connection.h>
 
 namespace hirediscc {
@@ -14,30 +20,110 @@ namespace hirediscc {
 class Connection;
 using ConnectionPtr = std::shared_ptr<Connection>;
 
-class Pipelined {
+namespace details {
+
+class PipelinedSlot {
 public:
-	explicit Pipelined(ConnectionPtr conn);
+	virtual ~PipelinedSlot() = default;
 
-	template <typename T, typename... Args>
-	void add(T arg, Args const &... args);
+	virtual void resolve(Connection &connection, std::shared_ptr<ReplyArena> const &arena) = 0;
 
-	void excute();
+	void fail(std::exception_ptr error) {
+		error_ = error;
+	}
+protected:
+	std::exception_ptr error_;
+};
+
+template <typename R>
+class TypedPipelinedSlot : public PipelinedSlot {
+public:
+	void resolve(Connection &connection, std::shared_ptr<ReplyArena> const &arena) override {
+		if (arena && !R::CopiesPayload) {
+			// The reply points into the arena, which the slot keeps alive.
+			arena_ = arena;
+			reply_.emplace(connection.excuteOnce<R>(*arena));
+		} else {
+			reply_.emplace(connection.excuteOnce<R>());
+		}
+	}
 
-	template <typename R>
-	R get();
+	// Takes a reply already read, e.g. by a ClusterPipeline.
+	void resolve(redisReply *reply) {
+		reply_.emplace(reply);
+	}
+
+	bool ready() const noexcept {
+		return reply_.has_value() || error_ != nullptr;
+	}
+
+	R & get() {
+		assert(ready() && "Pipelined::excute() has not been called");
+		if (error_)
+			std::rethrow_exception(error_);
+		return *reply_;
+	}
 private:
-	CommandArgs commandArgs_;
-	ConnectionPtr connection_;
+	// Declared first, so that it outlives the reply.
+	std::shared_ptr<ReplyArena> arena_;
+	std::optional<R> reply_;
 };
 
-template<typename T, typename ...Args>
-inline void Pipelined::add(T arg, Args const & ...args) {
-	connection_->append(commandArgs_, arg, args...);
 }
 
+// Handle to the reply of one command queued on a Pipelined, available once
+// the pipeline has been excuted.
 template <typename R>
-inline R Pipelined::get() {
-	return connection_->excuteOnce<R>();
+class PipelinedReply {
+public:
+	explicit PipelinedReply(std::shared_ptr<details::TypedPipelinedSlot<R>> slot)
+		: slot_(std::move(slot)) {
+	}
+
+	bool ready() const noexcept {
+		return slot_->ready();
+	}
+
+	// Rethrows the connection error if the batch failed before this reply
+	// was read.
+	R & get() {
+		return slot_->get();
+	}
+private:
+	std::shared_ptr<details::TypedPipelinedSlot<R>> slot_;
+};
+
+// Queues commands and sends them in a single write on excute(), then reads
+// the replies back in order into the handles returned by add().
+class Pipelined {
+public:
+	// With useArena, the replies of a batch are allocated from a ReplyArena
+	// shared with their handles, so a handle stays valid after the pipeline
+	// is gone. The next excute() reuses the arena once no handle of the
+	// previous batch is left and starts a new one otherwise.
+	explicit Pipelined(ConnectionPtr conn, bool useArena = false);
+
+	template <typename R = ReplyString, typename T, typename... Args>
+	PipelinedReply<R> add(T const &arg, Args const &... args);
+
+	size_t size() const noexcept {
+		return slots_.size();
+	}
+
+	void excute();
+private:
+	std::string requests_;
+	std::vector<std::shared_ptr<details::PipelinedSlot>> slots_;
+	ConnectionPtr connection_;
+	std::shared_ptr<ReplyArena> arena_;
+};
+
+template <typename R, typename T, typename... Args>
+inline PipelinedReply<R> Pipelined::add(T const &arg, Args const &... args) {
+	auto slot = std::make_shared<details::TypedPipelinedSlot<R>>();
+	CommandEncoder(requests_).encode(arg, args...);
+	slots_.push_back(slot);
+	return PipelinedReply<R>(std::move(slot));
 }
 
 }
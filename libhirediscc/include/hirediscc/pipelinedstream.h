@@ -0,0 +1,128 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <hirediscc/reply.h>
+#include <hirediscc/connection.h>
+#include <hirediscc/pipelinetuner.h>
+
+namespace hirediscc {
+
+class Connection;
+using ConnectionPtr = std::shared_ptr<Connection>;
+
+// Full-duplex pipeline for bulk jobs. At most window commands are in flight:
+// add() keeps sending queued requests while replies are drained and handed to
+// the handler in order, so memory stays bounded however many commands are
+// streamed. Call finish() to wait for the remaining replies.
+//
+// With AutoWindow the window and flush size are tuned by a PipelineTuner from
+// the measured RTT and reply sizes; metrics() reports what it chose.
+template <typename R = ReplyView>
+class PipelinedStream {
+public:
+	using Handler = std::function<void(R &reply)>;
+
+	enum {
+		AutoWindow = 0
+	};
+
+	PipelinedStream(ConnectionPtr conn, Handler handler, size_t window = AutoWindow)
+		: connection_(conn)
+		, handler_(std::move(handler))
+		, tuner_(window == AutoWindow ? PipelineTuner() : PipelineTuner(window, window))
+		, offset_(0)
+		, inFlight_(0)
+		, sent_(0)
+		, delivered_(0) {
+	}
+
+	PipelinedStream(PipelinedStream &&) = default;
+
+	PipelinedStream(PipelinedStream const &) = delete;
+	PipelinedStream& operator=(PipelinedStream const &) = delete;
+
+	~PipelinedStream() {
+		try {
+			if (connection_)
+				finish();
+		} catch (...) {
+		}
+	}
+
+	template <typename T, typename... Args>
+	void add(T const &arg, Args const &... args) {
+		auto size = requests_.size();
+		CommandEncoder(requests_).encode(arg, args...);
+		tuner_.onRequest(requests_.size() - size);
+		++inFlight_;
+		++sent_;
+		if (inFlight_ >= tuner_.window() || requests_.size() - offset_ >= tuner_.flushSize())
+			pump(tuner_.window() - 1);
+	}
+
+	void finish() {
+		pump(0);
+	}
+
+	size_t window() const noexcept {
+		return tuner_.window();
+	}
+
+	PipelineTuner::Metrics metrics() const noexcept {
+		return tuner_.metrics();
+	}
+
+	size_t inFlight() const noexcept {
+		return inFlight_;
+	}
+private:
+	// Sends everything queued and reads replies until no more than
+	// maxInFlight commands are waiting for theirs.
+	void pump(size_t maxInFlight) {
+		for (;;) {
+			deliver();
+			auto pending = requests_.size() - offset_;
+			if (pending == 0) {
+				requests_.clear();
+				offset_ = 0;
+				if (inFlight_ <= maxInFlight)
+					return;
+			}
+			size_t read = 0;
+			offset_ += connection_->pump(requests_.data() + offset_, pending, inFlight_ > 0, &read);
+			tuner_.onRead(read);
+			if (pending > 0 && offset_ == requests_.size())
+				tuner_.onFlushed(sent_);
+		}
+	}
+
+	void deliver() {
+		while (inFlight_ > 0) {
+			auto reply = connection_->tryExcuteOnce<R>();
+			if (!reply)
+				break;
+			--inFlight_;
+			tuner_.onReply(++delivered_);
+			handler_(*reply);
+		}
+	}
+
+	ConnectionPtr connection_;
+	Handler handler_;
+	PipelineTuner tuner_;
+	std::string requests_;
+	size_t offset_;
+	size_t inFlight_;
+	uint64_t sent_;
+	uint64_t delivered_;
+};
+
+}
@@ -0,0 +1,106 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace hirediscc {
+
+// Chooses the in-flight window and flush size of a streaming pipeline from
+// what it observes on the live stream: the round-trip time, the time the
+// server spends per request, the rate at which replies come back and the
+// average request and reply sizes. The window tracks twice the
+// bandwidth-delay product (reply rate * RTT), capped by the bytes allowed in
+// flight.
+//
+// A flushed request is timed until its reply, along with the number of
+// requests still unanswered ahead of it. That time grows by the server time
+// for each request ahead, so a least-squares fit of time against requests
+// ahead, over the recent samples, gives the server time as its slope and the
+// round trip without any queue as its intercept.
+class PipelineTuner {
+public:
+    struct Metrics {
+        size_t window;
+        size_t flushSize;
+        double rttMicros;
+        double serverMicros;
+        double repliesPerSecond;
+        double bytesPerRequest;
+        double bytesPerReply;
+    };
+
+    enum {
+        DefaultMinWindow = 16,
+        DefaultMaxWindow = 16384,
+        DefaultMaxInFlightBytes = 8 * 1024 * 1024
+    };
+
+    explicit PipelineTuner(size_t minWindow = DefaultMinWindow,
+        size_t maxWindow = DefaultMaxWindow,
+        size_t maxInFlightBytes = DefaultMaxInFlightBytes);
+
+    size_t window() const noexcept {
+        return window_;
+    }
+
+    size_t flushSize() const noexcept {
+        return flushSize_;
+    }
+
+    Metrics metrics() const noexcept;
+
+    void onRequest(size_t bytes) noexcept;
+
+    // Every request up to sequence has been written to the socket.
+    void onFlushed(uint64_t sequence) noexcept;
+
+    void onRead(size_t bytes) noexcept;
+
+    // The reply to request sequence has been delivered.
+    void onReply(uint64_t sequence) noexcept;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void retune() noexcept;
+
+    size_t const minWindow_;
+    size_t const maxWindow_;
+    size_t const maxInFlightBytes_;
+    size_t window_;
+    size_t flushSize_;
+
+    // Sums over the samples, decayed at every retune: count, requests
+    // ahead, time, requests ahead squared and their product with time.
+    struct Fit {
+        double n;
+        double ahead;
+        double micros;
+        double ahead2;
+        double aheadMicros;
+    };
+
+    bool probing_;
+    uint64_t probeSequence_;
+    uint64_t probeAhead_;
+    Clock::time_point probeStart_;
+    uint64_t delivered_;
+    Fit fit_;
+    double rtt_;
+    double serverMicros_;
+
+    Clock::time_point intervalStart_;
+    uint64_t intervalReplies_;
+    uint64_t intervalBytes_;
+    double repliesPerSecond_;
+    double bytesPerRequest_;
+    double bytesPerReply_;
+};
+
+}
@@ -0,0 +1,167 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hirediscc/connection.h>
+#include <hirediscc/iouring.h>
+#include <hirediscc/mpmc_bounded_queue.h>
+
+namespace hirediscc {
+
+class AsyncConnection;
+
+// Runs completions somewhere else than on the reactor thread, e.g. on a
+// thread pool. Every task handed to it must eventually be run.
+using Executor = std::function<void(std::function<void()>)>;
+
+// An event loop thread serving any number of AsyncConnections. Connections
+// hand it work through a lock-free ring: an entry is only pushed when a
+// connection goes from idle to having commands queued, so the ring carries
+// one entry per batch rather than one per command.
+//
+// With the IoUring transport the sends and receives of every connection
+// that has something to do go to the kernel in one io_uring_enter per turn
+// of the loop, instead of a poll plus a read and a write per socket. With
+// the Socket transport the loop waits in epoll where there is one. Either
+// way a turn only touches the connections that changed or became ready.
+//
+// Commands themselves are not carried by the ring: each AsyncConnection
+// gathers them in its own buffer under a mutex that only its senders and
+// this thread take, which keeps the encoding out of the reactor thread.
+//
+// Every connection attached to a reactor has to be destroyed before it.
+class Reactor {
+public:
+	enum {
+		DefaultRingCapacity = 4096
+	};
+
+	// Falls back to the Socket transport when io_uring is unavailable.
+	explicit Reactor(size_t ringCapacity = DefaultRingCapacity,
+		Transport transport = Transport::Socket);
+
+	Reactor(Reactor const &) = delete;
+	Reactor& operator=(Reactor const &) = delete;
+
+	~Reactor();
+
+	// Number of connections attached.
+	size_t connections() const noexcept {
+		return connections_.load(std::memory_order_relaxed);
+	}
+
+	// True on the reactor's own thread.
+	bool inLoop() const noexcept;
+
+	Transport transport() const noexcept {
+		return uring_ != nullptr ? Transport::IoUring : Transport::Socket;
+	}
+private:
+	friend class AsyncConnection;
+
+	// A connection's operations in flight on the io_uring.
+	struct Channel;
+
+	struct Event {
+		enum Type {
+			Attach,
+			Work,
+			Stop
+		};
+
+		Type type;
+		AsyncConnection *connection;
+	};
+
+	void schedule(Event::Type type, AsyncConnection *connection);
+	void wake();
+	void run();
+	void wait(int timeoutMs);
+	void dispatch(Event const &event, bool &stopping);
+	// Has the connection's interest handed to the kernel before the next wait.
+	void touch(AsyncConnection *connection);
+	void update(AsyncConnection *connection);
+	void reap();
+	// Fails connects past their deadline; returns the poll timeout.
+	int pollTimeout();
+
+	// The IoUring transport, on the reactor thread.
+	void attach(AsyncConnection *connection);
+	void detach(AsyncConnection *connection);
+	void arm(AsyncConnection *connection);
+	void complete(uint64_t data, int32_t result);
+	void reserve(unsigned entries);
+
+	// Set from AsyncConnection's hiredis cleanup hook.
+	void closing() noexcept {
+		reap_ = true;
+	}
+
+	mpmc_bounded_queue<Event> ring_;
+	// Events scheduled from the reactor thread itself while the ring was full.
+	std::vector<Event> overflow_;
+	std::vector<AsyncConnection*> attached_;
+	// Connections touched since the last wait.
+	std::vector<AsyncConnection*> dirty_;
+	// Connections with a connect deadline still running.
+	std::vector<AsyncConnection*> connecting_;
+	std::atomic<size_t> connections_;
+	bool reap_;
+	int wakeup_[2];
+	std::atomic<bool> sleeping_;
+	// The Socket transport's epoll instance, -1 without one.
+	int epoll_;
+	std::unique_ptr<details::IoUring> uring_;
+	// Channels of closed connections waiting for their operations to end.
+	size_t orphans_;
+	bool waking_;
+	char wakeBuffer_[64];
+	std::thread thread_;
+};
+
+// N reactors, one per core by default, with connections spread over them so
+// the client's throughput grows with the cores. Completions run on the
+// reactor that owns the connection, or through executor when one is given.
+//
+// Connections made by the engine have to be destroyed before it.
+class IoEngine {
+public:
+	explicit IoEngine(size_t reactors = 0,
+		Executor executor = nullptr,
+		Transport transport = Transport::Socket);
+
+	IoEngine(IoEngine const &) = delete;
+	IoEngine& operator=(IoEngine const &) = delete;
+
+	// Connects on the reactor with the fewest connections.
+	std::unique_ptr<AsyncConnection> connect(std::string const &host,
+		uint16_t port,
+		std::string const &password = "",
+		uint32_t timeout = Connection::DefaultTimeout);
+
+	Reactor &leastLoaded() noexcept;
+
+	size_t size() const noexcept {
+		return reactors_.size();
+	}
+
+	Executor const &executor() const noexcept {
+		return executor_;
+	}
+private:
+	std::vector<std::unique_ptr<Reactor>> reactors_;
+	Executor executor_;
+};
+
+}
@@ -6,7 +6,13 @@
 #pragma once
 
 #include <cassert>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 #include <hirediscc/details.h>
+#include <hirediscc/replybuilder.h>
 
 namespace hirediscc {
 
@@ -27,18 +33,18 @@ public:
 	};
 
 	ReplyBase()
-		: type_(Null)
-		, reply_(nullptr) {
+		: reply_(nullptr)
+		, type_(Null) {
 	}
 
 	ReplyBase(Type type)
-		: type_(type)
-		, reply_(nullptr) {
+		: reply_(nullptr)
+		, type_(type) {
 	}
 
 	explicit ReplyBase(redisReply *reply)
-		: type_(Null)
-		, reply_(reply) {
+		: reply_(reply)
+		, type_(Null) {
 		type_ = static_cast<Type>(details::getRedisReplyType(reply));
 	}
 
@@ -54,6 +60,14 @@ public:
 		return static_cast<T*>(this)->deserialize(reply);
 	}
 
+	// Gives up ownership of the hiredis reply, e.g. when it lives in a
+	// ReplyArena that is released as a whole.
+	redisReply *release() noexcept {
+		auto reply = reply_;
+		reply_ = nullptr;
+		return reply;
+	}
+
 	bool hasError() const noexcept {
 		return false;
 	}
@@ -73,6 +87,12 @@ public:
 	bool isStatus() const noexcept {
 		return type_ == Status;
 	}
+
+	bool isNull() const noexcept {
+		return type_ == Null;
+	}
+
+	static constexpr bool CopiesPayload = false;
 protected:
 	redisReply *reply_;
 	Type type_;
@@ -121,10 +141,15 @@ private:
 	int64_t value_;
 };
 
+// Copies the payload out and frees the hiredis reply straight away; use
+// ReplyView to borrow it instead.
 class ReplyString : public ReplyBase<ReplyString, std::string> {
 public:
 	using ValueType = std::string;
 
+	// Nothing is left for a ReplyArena to keep once constructed.
+	static constexpr bool CopiesPayload = true;
+
 	ReplyString()
 		: ReplyBase(String) {
 	}
@@ -132,6 +157,7 @@ public:
 	explicit ReplyString(redisReply *reply)
 		: ReplyBase(reply) {
 		deserialize(reply);
+		details::deleteRedisReply(release());
 	}
 
 	ReplyString(ReplyString &&other) {
@@ -149,10 +175,14 @@ public:
 		return *this;
 	}
 
-	std::string value() const {
+	std::string const & value() const & {
 		return value_;
 	}
 
+	std::string value() && {
+		return std::move(value_);
+	}
+
 	void deserialize(redisReply *reply) {
 		assert(isString() || isError() || isStatus());
 		details::deserializeRedisReply(reply, value_);
@@ -161,15 +191,63 @@ private:
 	std::string value_;
 };
 
+// Borrows the payload from the hiredis reply instead of copying it. The view
+// returned by value() is valid for as long as this object (or, for elements
+// of a ReplyArray<ReplyView>, the owning array) is alive.
+class ReplyView : public ReplyBase<ReplyView, std::string_view> {
+public:
+	using ValueType = std::string_view;
+
+	ReplyView()
+		: ReplyBase(String) {
+	}
+
+	explicit ReplyView(redisReply *reply)
+		: ReplyBase(reply) {
+		deserialize(reply);
+	}
+
+	ReplyView(ReplyView &&other) {
+		*this = std::move(other);
+	}
+
+	ReplyView& operator=(ReplyView &&other) {
+		if (this != &other) {
+			reply_ = other.reply_;
+			type_ = other.type_;
+			value_ = other.value_;
+			other.reply_ = nullptr;
+			other.type_ = Null;
+			other.value_ = {};
+		}
+		return *this;
+	}
+
+	std::string_view value() const {
+		return value_;
+	}
+
+	void deserialize(redisReply *reply) {
+		type_ = static_cast<Type>(details::getRedisReplyType(reply));
+		assert(isString() || isError() || isStatus() || isNull());
+		details::deserializeRedisReply(reply, value_);
+	}
+private:
+	std::string_view value_;
+};
+
 template <typename T>
 class ReplyArray : public ReplyBase<ReplyArray<T>, std::vector<T>> {
+	using Base = ReplyBase<ReplyArray<T>, std::vector<T>>;
+	using Base::reply_;
+	using Base::type_;
 public:
 	ReplyArray()
-		: ReplyBase(Array) {
+		: Base(Base::Array) {
 	}
 
 	explicit ReplyArray(redisReply *reply)
-		: ReplyBase(reply) {
+		: Base(reply) {
 		deserialize(reply);
 	}
 
@@ -183,11 +261,19 @@ public:
 			type_ = other.type_;
 			value_ = std::move(other.value_);
 			other.reply_ = nullptr;
-			other.type_ = Null;
+			other.type_ = Base::Null;
 		}
 		return *this;
 	}
 
+	size_t size() const {
+		return value_.size();
+	}
+
+	T const & operator[](size_t index) const {
+		return value_[index];
+	}
+
 	std::vector<typename T::ValueType> value() const {
 		std::vector<typename T::ValueType> values;
 		values.reserve(value_.size());
@@ -212,6 +298,108 @@ private:
 	std::vector<T> value_;
 };
 
+using ReplyArrayView = ReplyArray<ReplyView>;
+
+// Filled by the parser through ReplyBuilder, so no redisReply tree is built.
+// Elements of an array reply become strings (nil ones empty, integers in
+// decimal); a single bulk or status reply becomes a one-element list. The
+// elements of nested arrays are appended in order, flattened into the one
+// list. An error reply sets isError() and leaves its text as the only
+// element, so check isError() before taking value().
+class ReplyStringList : public ReplyBuilder {
+public:
+	using ValueType = std::vector<std::string>;
+
+	std::vector<std::string> const & value() const & {
+		return value_;
+	}
+
+	std::vector<std::string> value() && {
+		return std::move(value_);
+	}
+
+	bool isError() const noexcept {
+		return isError_;
+	}
+
+	void onString(int32_t type, char const *str, size_t len, size_t depth) override {
+		if (depth == 0 && type == ReplyString::Error) {
+			isError_ = true;
+			value_.assign(1, std::string(str, len));
+			return;
+		}
+		value_.emplace_back(str, len);
+	}
+
+	void onArray(size_t elements, size_t depth) override {
+		if (depth == 0)
+			value_.reserve(elements);
+	}
+
+	void onInteger(int64_t value, size_t) override {
+		value_.push_back(std::to_string(value));
+	}
+
+	void onNull(size_t depth) override {
+		if (depth != 0)
+			value_.emplace_back();
+	}
+private:
+	std::vector<std::string> value_;
+	bool isError_ = false;
+};
+
+// Stores every element of an array reply back to back in one buffer plus an
+// offset table, so an N element reply costs a couple of allocations instead
+// of N strings. Nested arrays are flattened as by ReplyStringList.
+class ReplyFlatArray : public ReplyBuilder {
+public:
+	size_t size() const {
+		return offsets_.empty() ? 0 : offsets_.size() - 1;
+	}
+
+	std::string_view operator[](size_t index) const {
+		return std::string_view(data_.data() + offsets_[index],
+			offsets_[index + 1] - offsets_[index]);
+	}
+
+	bool isError() const noexcept {
+		return isError_;
+	}
+
+	void onString(int32_t type, char const *str, size_t len, size_t depth) override {
+		if (depth == 0 && type == ReplyString::Error)
+			isError_ = true;
+		data_.append(str, len);
+		push();
+	}
+
+	void onArray(size_t elements, size_t depth) override {
+		if (depth == 0)
+			offsets_.reserve(elements + 1);
+	}
+
+	void onInteger(int64_t value, size_t) override {
+		data_.append(std::to_string(value));
+		push();
+	}
+
+	void onNull(size_t depth) override {
+		if (depth != 0)
+			push();
+	}
+private:
+	void push() {
+		if (offsets_.empty())
+			offsets_.push_back(0);
+		offsets_.push_back(data_.size());
+	}
+
+	std::string data_;
+	std::vector<size_t> offsets_;
+	bool isError_ = false;
+};
+
 #pragma endregion Reply
 
 }
@@ -0,0 +1,33 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hirediscc {
+
+// Receives a reply while hiredis parses it, instead of a redisReply tree.
+// Elements arrive in protocol order; depth is 0 for the top-level reply,
+// 1 for elements of a top-level array and so on. type is one of the
+// ReplyBase::Type values (String, Status or Error for onString).
+class ReplyBuilder {
+public:
+    // What a builder keeps is copied out of the parser's buffer.
+    static constexpr bool CopiesPayload = true;
+
+    virtual ~ReplyBuilder() = default;
+
+    virtual void onString(int32_t type, char const *str, size_t len, size_t depth) = 0;
+
+    virtual void onArray(size_t elements, size_t depth) = 0;
+
+    virtual void onInteger(int64_t value, size_t depth) = 0;
+
+    virtual void onNull(size_t depth) = 0;
+};
+
+}
@@ -38,15 +38,15 @@ void clientEcho() {
 }
 
 void connectionPoolTest() {
-	hirediscc::ConnectionPool connPool({
-		1024,
-		4096,
-		100,
-		100,
-		100,
-		"127.0.0.1",
-		6379
-	});
+	hirediscc::ConnectionPool::Configuration config{};
+	config.initCapacity = 1024;
+	config.maxCapacity = 4096;
+	config.capacityIncrement = 100;
+	config.maxIdleTimeout = 100;
+	config.maxIdle = 100;
+	config.host = "127.0.0.1";
+	config.port = 6379;
+	hirediscc::ConnectionPool connPool(config);
 
 	using namespace std::this_thread;
 	using namespace std::chrono;
@@ -75,13 +75,16 @@ void pipelinTest() {
 	hirediscc::Client client("127.0.0.1", 6379);
 
 	auto pipeline = client.pipelined();
+	std::vector<hirediscc::PipelinedReply<hirediscc::ReplyString>> replies;
 	for (int i = 0; i < 100; ++i)
-		pipeline.add("PING");
+		replies.push_back(pipeline.add("PING"));
+	auto count = pipeline.add<hirediscc::ReplyInterger>("DEL", "mykey");
 
 	pipeline.excute();
 
-	for (int i = 0; i < 100; ++i)
-		pipeline.get<hirediscc::ReplyString>();
+	for (auto &reply : replies)
+		reply.get().value();
+	count.get().value();
 }
 
 int main() {
@@ -0,0 +1,56 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+
+#include <hirediscc/arena.h>
+
+namespace hirediscc {
+
+ReplyArena::ReplyArena(size_t chunkSize)
+    : chunkSize_(chunkSize)
+    , current_(0)
+    , offset_(0) {
+}
+
+ReplyArena::~ReplyArena() {
+}
+
+void *ReplyArena::allocate(size_t size, size_t alignment) {
+    for (; current_ < chunks_.size(); ++current_, offset_ = 0) {
+        auto &chunk = chunks_[current_];
+        auto base = reinterpret_cast<uintptr_t>(chunk.data.get());
+        auto aligned = (base + offset_ + alignment - 1) & ~(uintptr_t(alignment) - 1);
+        if (aligned + size <= base + chunk.size) {
+            offset_ = aligned + size - base;
+            return reinterpret_cast<void*>(aligned);
+        }
+    }
+
+    // Nothing left in the existing chunks, oversized requests get a chunk of
+    // their own.
+    Chunk chunk;
+    chunk.size = std::max<size_t>(chunkSize_, size + alignment);
+    chunk.data.reset(new char[chunk.size]);
+    chunks_.push_back(std::move(chunk));
+    current_ = chunks_.size() - 1;
+    offset_ = 0;
+    return allocate(size, alignment);
+}
+
+void ReplyArena::reset() noexcept {
+    current_ = 0;
+    offset_ = 0;
+}
+
+size_t ReplyArena::bytesAllocated() const noexcept {
+    size_t total = 0;
+    for (auto const &chunk : chunks_)
+        total += chunk.size;
+    return total;
+}
+
+}
@@ -0,0 +1,334 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <hiredis.h>
+#include <async.h>
+extern "C" {
+#include <sds.h>
+}
+
+#include <hirediscc/exception.h>
+#include <hirediscc/asyncclient.h>
+
+namespace hirediscc {
+
+namespace {
+
+std::exception_ptr errorOf(int error) {
+    return std::make_exception_ptr(Exception(error != 0 ? error : REDIS_ERR_EOF));
+}
+
+}
+
+AsyncConnection::AsyncConnection(std::string const &host,
+    uint16_t port,
+    std::string const &password,
+    uint32_t timeout)
+    : ownReactor_(std::make_unique<Reactor>())
+    , reactor_(ownReactor_.get())
+    , context_(nullptr)
+    , channel_(nullptr)
+    , reading_(false)
+    , writing_(false)
+    , dirty_(false)
+    , watched_(false)
+    , events_(0)
+    , disconnecting_(false)
+    , closing_(false)
+    , lastError_(0)
+    , connectDone_(false)
+    , stopped_(false)
+    , woken_(false)
+    , commands_(0)
+    , writes_(0) {
+    open(host, port, password, timeout);
+}
+
+AsyncConnection::AsyncConnection(Reactor &reactor,
+    std::string const &host,
+    uint16_t port,
+    std::string const &password,
+    uint32_t timeout,
+    Executor executor)
+    : reactor_(&reactor)
+    , executor_(std::move(executor))
+    , context_(nullptr)
+    , channel_(nullptr)
+    , reading_(false)
+    , writing_(false)
+    , dirty_(false)
+    , watched_(false)
+    , events_(0)
+    , disconnecting_(false)
+    , closing_(false)
+    , lastError_(0)
+    , connectDone_(false)
+    , stopped_(false)
+    , woken_(false)
+    , commands_(0)
+    , writes_(0) {
+    open(host, port, password, timeout);
+}
+
+AsyncConnection::~AsyncConnection() {
+    shutdown();
+}
+
+void AsyncConnection::shutdown() {
+    auto released = released_.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        if (!woken_) {
+            woken_ = true;
+            reactor_->schedule(Reactor::Event::Work, this);
+        }
+    }
+    released.wait();
+}
+
+void AsyncConnection::open(std::string const &host,
+    uint16_t port,
+    std::string const &password,
+    uint32_t timeout) {
+    context_ = ::redisAsyncConnect(host.c_str(), port);
+    if (context_ == nullptr)
+        throw Exception(REDIS_ERR_OOM);
+    if (context_->err != 0) {
+        auto error = context_->err;
+        ::redisAsyncFree(context_);
+        throw Exception(error);
+    }
+
+    details::makeRepliesDetachable(&context_->c);
+    context_->data = this;
+    context_->ev.data = this;
+    context_->ev.addRead = addRead;
+    context_->ev.delRead = delRead;
+    context_->ev.addWrite = addWrite;
+    context_->ev.delWrite = delWrite;
+    context_->ev.cleanup = cleanup;
+    ::redisAsyncSetConnectCallback(context_, onConnect);
+    // The first writable event completes the connect.
+    writing_ = true;
+    deadline_ = Clock::now() + std::chrono::seconds(timeout);
+
+    auto connected = connected_.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        woken_ = true;
+        reactor_->schedule(Reactor::Event::Attach, this);
+    }
+    try {
+        connected.get();
+    } catch (...) {
+        released_.get_future().wait();
+        throw;
+    }
+
+    if (password.empty())
+        return;
+    // Every later command would fail with NOAUTH, so report it here.
+    auto auth = send<ReplyString, commands::Auth>(password);
+    try {
+        if (auth.get().isError())
+            throw Exception(REDIS_ERR_OTHER);
+    } catch (...) {
+        shutdown();
+        throw;
+    }
+}
+
+void AsyncConnection::service() {
+    std::string requests;
+    std::deque<Request> waiters;
+    bool stopped;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests.swap(pending_);
+        waiters.swap(waiters_);
+        stopped = stopped_;
+        woken_ = false;
+    }
+    if (closing_) {
+        release();
+        return;
+    }
+
+    submit(requests, waiters);
+
+    if (context_ != nullptr && stopped && !disconnecting_) {
+        // Flushes what is queued and waits for its replies first.
+        disconnecting_ = true;
+        ::redisAsyncDisconnect(context_);
+    }
+}
+
+void AsyncConnection::handle(bool readable, bool writable, bool failed) {
+    // Either handler may free the context through cleanup().
+    if (context_ != nullptr && (failed || (reading_ && readable)))
+        ::redisAsyncHandleRead(context_);
+    if (context_ != nullptr && writing_ && writable) {
+        if (::sdslen(context_->c.obuf) > 0)
+            ++writes_;
+        ::redisAsyncHandleWrite(context_);
+    }
+}
+
+bool AsyncConnection::expire(Clock::time_point now) {
+    if (context_ == nullptr || connectDone_ || now < deadline_)
+        return false;
+    context_->c.err = REDIS_ERR_IO;
+    std::snprintf(context_->c.errstr, sizeof(context_->c.errstr), "Connection timed out");
+    ::redisAsyncFree(context_);
+    return true;
+}
+
+void AsyncConnection::close() {
+    auto error = errorOf(lastError_);
+    if (!connectDone_) {
+        connectDone_ = true;
+        connected_.set_exception(error);
+    }
+
+    std::deque<Request> waiters;
+    bool inFlight;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = error;
+        waiters.swap(waiters_);
+        pending_.clear();
+        // No event is scheduled for the connection from now on.
+        inFlight = woken_;
+        woken_ = true;
+    }
+    for (auto &request : waiters)
+        complete(std::move(request.waiter), nullptr, error);
+    waiters.clear();
+
+    // The event already on its way to the reactor still points here.
+    if (inFlight)
+        closing_ = true;
+    else
+        release();
+}
+
+void AsyncConnection::release() {
+    // The owner may destroy the connection as soon as this is set.
+    released_.set_value();
+}
+
+void AsyncConnection::submit(std::string const &requests, std::deque<Request> &waiters) {
+    size_t offset = 0;
+    while (!waiters.empty()) {
+        auto &request = waiters.front();
+        auto waiter = request.waiter.get();
+        if (context_ != nullptr
+            && ::redisAsyncFormattedCommand(context_, onReply, waiter, requests.data() + offset, request.size) == REDIS_OK) {
+            // onReply owns it now.
+            request.waiter.release();
+        } else {
+            complete(std::move(request.waiter), nullptr,
+                errorOf(context_ != nullptr ? REDIS_ERR_OTHER : lastError_));
+        }
+        offset += request.size;
+        waiters.pop_front();
+    }
+}
+
+void AsyncConnection::complete(details::AsyncWaiterPtr waiter, redisReply *reply, std::exception_ptr error) {
+    if (executor_) {
+        executor_([waiter = waiter.release(), reply, error]() {
+            details::AsyncWaiterPtr owned(waiter);
+            if (error)
+                owned->fail(error);
+            else
+                owned->resolve(reply);
+        });
+        return;
+    }
+    try {
+        if (error)
+            waiter->fail(error);
+        else
+            waiter->resolve(reply);
+    } catch (...) {
+        // A throwing handler must not unwind through hiredis.
+    }
+}
+
+void AsyncConnection::onConnect(redisAsyncContext const *context, int status) {
+    auto self = static_cast<AsyncConnection*>(context->data);
+    if (status != REDIS_OK)
+        return;
+    self->connectDone_ = true;
+    self->connected_.set_value();
+}
+
+void AsyncConnection::onReply(redisAsyncContext *context, void *reply, void *privdata) {
+    auto self = static_cast<AsyncConnection*>(context->data);
+    details::AsyncWaiterPtr waiter(static_cast<details::AsyncWaiter*>(privdata));
+    if (reply == nullptr) {
+        self->complete(std::move(waiter), nullptr, errorOf(context->c.err));
+        return;
+    }
+    details::detachReply(static_cast<redisReply*>(reply));
+    self->complete(std::move(waiter), static_cast<redisReply*>(reply), nullptr);
+}
+
+// Only a change has to reach the reactor. hiredis already asks for a write
+// from open(), before the connection is attached; Attach picks that up.
+void AsyncConnection::interest(bool &flag, bool value) {
+    if (flag == value)
+        return;
+    flag = value;
+    if (reactor_->inLoop())
+        reactor_->touch(this);
+}
+
+void AsyncConnection::addRead(void *privdata) {
+    auto self = static_cast<AsyncConnection*>(privdata);
+    self->interest(self->reading_, true);
+}
+
+void AsyncConnection::delRead(void *privdata) {
+    auto self = static_cast<AsyncConnection*>(privdata);
+    self->interest(self->reading_, false);
+}
+
+void AsyncConnection::addWrite(void *privdata) {
+    auto self = static_cast<AsyncConnection*>(privdata);
+    self->interest(self->writing_, true);
+}
+
+void AsyncConnection::delWrite(void *privdata) {
+    auto self = static_cast<AsyncConnection*>(privdata);
+    self->interest(self->writing_, false);
+}
+
+void AsyncConnection::cleanup(void *privdata) {
+    auto self = static_cast<AsyncConnection*>(privdata);
+    self->lastError_ = self->context_->c.err;
+    self->context_ = nullptr;
+    self->reading_ = false;
+    self->writing_ = false;
+    self->reactor_->closing();
+}
+
+AsyncClient::AsyncClient(std::string const &host,
+    uint16_t port,
+    std::string const &password)
+    : connection_(std::make_unique<AsyncConnection>(host, port, password)) {
+}
+
+AsyncClient::AsyncClient(IoEngine &engine,
+    std::string const &host,
+    uint16_t port,
+    std::string const &password)
+    : connection_(engine.connect(host, port, password)) {
+}
+
+}
@@ -4,6 +4,9 @@
 //---------------------------------------------------------------------------------------------------------------------
 
 #include <cassert>
+#include <utility>
+#include <hiredis.h>
+#include <hirediscc/exception.h>
 #include <hirediscc/connection.h>
 #include <hirediscc/reply.h>
 #include <hirediscc/client.h>
@@ -17,12 +20,19 @@ Client::Client(std::string const & host, uint16_t port, std::string const & pass
         connection_->setAuth(password);
 }
 
+Client::Client(UnixSocket const &socket, std::string const &password) {
+    connection_ = std::make_unique<Connection>();
+    connection_->connect(socket);
+    if (!password.empty())
+        connection_->setAuth(password);
+}
+
 void Client::quit() {
-    connection_->excuteCommandWithArgs<ReplyString>("QUIT").value();
+    connection_->excuteCommand<ReplyString, commands::Quit>().value();
 }
 
-Pipelined Client::pipelined() {
-	return Pipelined(connection_);
+Pipelined Client::pipelined(bool useArena) {
+	return Pipelined(connection_, useArena);
 }
 
 Client::Client(ConnectionPtr conn)
@@ -33,12 +43,23 @@ Client::Client(ConnectionPtr conn)
 Client::~Client() {
 }
 
+std::string Client::ping() {
+    return connection_->ping();
+}
+
 std::string Client::get(std::string const & key) {
-    return connection_->excuteCommandWithArgs<ReplyString>("GET", key).value();
+    return connection_->excuteCommand<ReplyString, commands::Get>(key).value();
+}
+
+ReplyView Client::getView(std::string const & key) {
+    return connection_->excuteCommand<ReplyView, commands::Get>(key);
 }
 
 std::vector<std::string> Client::keys() {
-    return connection_->excuteCommandWithArgs<ReplyArray<ReplyString>>("KEYS", "*").value();
+    auto reply = connection_->excuteCommand<ReplyStringList, commands::Keys>("*");
+    if (reply.isError())
+        throw Exception(REDIS_ERR_OTHER);
+    return std::move(reply).value();
 }
 
 }
@@ -0,0 +1,464 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <numeric>
+#include <thread>
+#include <unordered_set>
+#include <hiredis.h>
+
+#include <hirediscc/exception.h>
+#include <hirediscc/connection.h>
+#include <hirediscc/cluster.h>
+
+namespace hirediscc {
+
+namespace {
+
+// The table of src/crc16.c: CRC16-CCITT (XMODEM), polynomial 0x1021.
+constexpr std::array<uint16_t, 256> makeCrc16Table() {
+    std::array<uint16_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i << 8;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        table[i] = static_cast<uint16_t>(crc);
+    }
+    return table;
+}
+
+constexpr auto crc16Table = makeCrc16Table();
+
+static_assert(crc16Table[1] == 0x1021 && crc16Table[255] == 0x1ef0, "CRC16 table differs from src/crc16.c");
+
+uint16_t crc16(char const *data, size_t size) noexcept {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < size; ++i)
+        crc = static_cast<uint16_t>((crc << 8) ^ crc16Table[((crc >> 8) ^ static_cast<uint8_t>(data[i])) & 0xff]);
+    return crc;
+}
+
+std::string nameOf(std::string const &host, uint16_t port) {
+    return host + ":" + std::to_string(port);
+}
+
+// How long a command waits before it is sent again after TRYAGAIN, i.e.
+// while the keys of a multi-key command are half way through a migration.
+constexpr std::chrono::milliseconds TryAgainDelay(10);
+
+// Parses text that is a decimal number up to max and nothing else.
+bool parseNumber(std::string_view text, uint32_t max, uint32_t &value) noexcept {
+    auto end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end && value <= max;
+}
+
+// The commands of a ClusterPipeline round that go to one node.
+struct NodeBatch {
+    std::shared_ptr<ConnectionPool> pool;
+    ConnectionPtr connection;
+    std::string requests;
+    std::vector<size_t> commands;
+    std::exception_ptr error;
+};
+
+}
+
+uint16_t keySlot(std::string_view key) noexcept {
+    auto open = key.find('{');
+    if (open != std::string_view::npos) {
+        auto close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close != open + 1)
+            key = key.substr(open + 1, close - open - 1);
+    }
+    return crc16(key.data(), key.size()) & (ClusterClient::SlotCount - 1);
+}
+
+namespace details {
+
+Redirect parseRedirect(redisReply *reply) {
+    Redirect redirect { Redirect::None, 0, {}, 0 };
+    if (reply == nullptr || reply->type != REDIS_REPLY_ERROR)
+        return redirect;
+    std::string_view error(reply->str, reply->len);
+    if (error.compare(0, 9, "TRYAGAIN ") == 0 || error == "TRYAGAIN") {
+        redirect.type = Redirect::TryAgain;
+        return redirect;
+    }
+
+    // MOVED <slot> <host>:<port> and ASK <slot> <host>:<port>.
+    Redirect::Type type;
+    if (error.compare(0, 6, "MOVED ") == 0)
+        type = Redirect::Moved;
+    else if (error.compare(0, 4, "ASK ") == 0)
+        type = Redirect::Ask;
+    else
+        return redirect;
+    auto slotAt = error.find(' ') + 1;
+    auto addressAt = error.find(' ', slotAt);
+    auto portAt = error.rfind(':');
+    if (addressAt == std::string_view::npos || portAt == std::string_view::npos || portAt <= addressAt + 1)
+        return redirect;
+    uint32_t slot;
+    uint32_t port;
+    // Anything else is an error reply like any other, not slot 0 or port 0.
+    if (!parseNumber(error.substr(slotAt, addressAt - slotAt), ClusterClient::SlotCount - 1, slot)
+        || !parseNumber(error.substr(portAt + 1), UINT16_MAX, port)
+        || port == 0)
+        return redirect;
+    redirect.type = type;
+    redirect.slot = static_cast<uint16_t>(slot);
+    redirect.host = std::string(error.substr(addressAt + 1, portAt - addressAt - 1));
+    redirect.port = static_cast<uint16_t>(port);
+    return redirect;
+}
+
+}
+
+ClusterClient::ClusterClient(Configuration configuration)
+    : configuration_(std::move(configuration))
+    , slots_(SlotCount)
+    , refreshPending_(false)
+    , stopped_(false) {
+    refresh();
+    thread_ = std::thread([this]() {
+        refresher();
+    });
+}
+
+ClusterClient::~ClusterClient() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        stopped_ = true;
+    }
+    refreshWanted_.notify_one();
+    thread_.join();
+}
+
+size_t ClusterClient::nodes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return nodes_.size();
+}
+
+void ClusterClient::refresh() {
+    std::lock_guard<std::mutex> lock(refreshMutex_);
+    std::vector<Address> addresses;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        addresses = nodes_;
+    }
+    addresses.insert(addresses.end(), configuration_.seeds.begin(), configuration_.seeds.end());
+    for (auto const &address : addresses) {
+        if (load(address))
+            return;
+    }
+    throw Exception(REDIS_ERR_IO);
+}
+
+void ClusterClient::refreshSoon() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        refreshPending_ = true;
+    }
+    refreshWanted_.notify_one();
+}
+
+void ClusterClient::refresher() {
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    for (;;) {
+        refreshWanted_.wait(lock, [this]() {
+            return stopped_ || refreshPending_;
+        });
+        if (stopped_)
+            return;
+        refreshPending_ = false;
+        lock.unlock();
+        try {
+            refresh();
+        } catch (...) {
+            // The next redirect or connection error tries again.
+        }
+        lock.lock();
+    }
+}
+
+// Reads the slot table from one node, opens pools for the masters in it and
+// drops those of the nodes it leaves out.
+bool ClusterClient::load(Address const &address) {
+    details::RawReply reply;
+    try {
+        Connection conn;
+        conn.connect(address.host, address.port);
+        if (!configuration_.password.empty())
+            conn.setAuth(configuration_.password);
+        reply = conn.excuteCommand<details::RawReply, commands::Cluster>("SLOTS");
+    } catch (Exception const &) {
+        return false;
+    }
+
+    // [[start, end, [host, port, ...], replicas...], ...]
+    auto table = reply.get();
+    if (table->type != REDIS_REPLY_ARRAY)
+        return false;
+    std::vector<PoolPtr> slots(SlotCount);
+    std::unordered_set<ConnectionPool*> serving;
+    for (size_t i = 0; i < table->elements; ++i) {
+        auto range = table->element[i];
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3)
+            continue;
+        auto master = range->element[2];
+        if (master->type != REDIS_REPLY_ARRAY || master->elements < 2)
+            continue;
+        std::string host(master->element[0]->str, master->element[0]->len);
+        // An empty host is the node that was asked.
+        if (host.empty())
+            host = address.host;
+        PoolPtr pool;
+        try {
+            pool = poolOf(host, static_cast<uint16_t>(master->element[1]->integer));
+        } catch (Exception const &) {
+            // Unreachable for now; its slots get a MOVED or an error.
+            continue;
+        }
+        auto first = std::max<PORT_LONGLONG>(range->element[0]->integer, 0);
+        auto last = std::min<PORT_LONGLONG>(range->element[1]->integer, SlotCount - 1);
+        for (auto slot = first; slot <= last; ++slot)
+            slots[static_cast<size_t>(slot)] = pool;
+        serving.insert(pool.get());
+    }
+
+    // Closed once the lock is released and the commands using them are done.
+    std::vector<PoolPtr> dropped;
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    slots_.swap(slots);
+    for (auto itr = pools_.begin(); itr != pools_.end();) {
+        if (serving.count(itr->second.get()) == 0) {
+            dropped.push_back(std::move(itr->second));
+            itr = pools_.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+    nodes_.erase(std::remove_if(nodes_.begin(), nodes_.end(), [this](Address const &node) {
+        return pools_.count(nameOf(node.host, node.port)) == 0;
+    }), nodes_.end());
+    return true;
+}
+
+ClusterClient::PoolPtr ClusterClient::poolOf(uint16_t slot) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto const &pool = slots_[slot];
+    if (pool != nullptr)
+        return pool;
+    // No node known for the slot: any node answers with a MOVED.
+    if (pools_.empty())
+        throw Exception(REDIS_ERR_OTHER);
+    return pools_.begin()->second;
+}
+
+ClusterClient::PoolPtr ClusterClient::poolOf(std::string const &host, uint16_t port) {
+    auto name = nameOf(host, port);
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto itr = pools_.find(name);
+        if (itr != pools_.end())
+            return itr->second;
+    }
+
+    // Connects without the lock; should two threads race, one pool is kept.
+    auto config = configuration_.pool;
+    config.host = host;
+    config.port = port;
+    config.password = configuration_.password;
+    config.unixSocket.clear();
+    auto pool = std::make_shared<ConnectionPool>(std::move(config));
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto &entry = pools_[name];
+    if (entry == nullptr) {
+        entry = std::move(pool);
+        nodes_.push_back(Address { host, port });
+    }
+    return entry;
+}
+
+ClusterClient::PoolPtr ClusterClient::moved(details::Redirect const &redirect) {
+    auto pool = poolOf(redirect.host, redirect.port);
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        slots_[redirect.slot % SlotCount] = pool;
+    }
+    return pool;
+}
+
+redisReply *ClusterClient::excute(uint16_t slot, std::string const &request) {
+    std::string asking;
+    auto pool = poolOf(slot);
+    for (uint32_t redirects = 0; ; ++redirects) {
+        details::RawReply reply;
+        try {
+            auto conn = pool->borrowConnection();
+            if (!asking.empty()) {
+                // ASKING holds for the next command only.
+                asking.append(request);
+                conn->write(asking);
+                asking.clear();
+                conn->excuteOnce<details::RawReply>();
+            } else {
+                conn->write(request);
+            }
+            reply = conn->excuteOnce<details::RawReply>();
+        } catch (Exception const &) {
+            // The node may have failed over.
+            refreshSoon();
+            throw;
+        }
+
+        auto redirect = details::parseRedirect(reply.get());
+        if (redirect.type == details::Redirect::None || redirects >= configuration_.maxRedirects)
+            return reply.release();
+        switch (redirect.type) {
+        case details::Redirect::Moved:
+            pool = moved(redirect);
+            // A slot seldom moves alone.
+            refreshSoon();
+            break;
+        case details::Redirect::Ask:
+            pool = poolOf(redirect.host, redirect.port);
+            CommandEncoder(asking).encode<commands::Asking>();
+            break;
+        default:
+            std::this_thread::sleep_for(TryAgainDelay);
+            break;
+        }
+    }
+}
+
+ClusterPipeline ClusterClient::pipelined() {
+    return ClusterPipeline(*this);
+}
+
+ClusterPipeline::ClusterPipeline(ClusterClient &client)
+    : client_(client) {
+}
+
+void ClusterPipeline::excute() {
+    auto requests = std::move(requests_);
+    auto commands = std::move(commands_);
+    requests_.clear();
+    commands_.clear();
+
+    // The node an ASK sent a command to, for its next round only.
+    std::vector<std::shared_ptr<ConnectionPool>> asked(commands.size());
+    std::vector<size_t> pending(commands.size());
+    std::iota(pending.begin(), pending.end(), 0);
+    std::exception_ptr firstError;
+    auto fail = [&](size_t index, std::exception_ptr error) {
+        commands[index].reply->fail(error);
+        if (!firstError)
+            firstError = error;
+    };
+
+    for (uint32_t round = 0; !pending.empty(); ++round) {
+        std::vector<NodeBatch> batches;
+        for (auto index : pending) {
+            auto &command = commands[index];
+            auto pool = asked[index];
+            if (pool == nullptr) {
+                try {
+                    pool = client_.poolOf(command.slot);
+                } catch (...) {
+                    fail(index, std::current_exception());
+                    continue;
+                }
+            }
+            auto batch = std::find_if(batches.begin(), batches.end(),
+                [&pool](NodeBatch const &batch) { return batch.pool == pool; });
+            if (batch == batches.end())
+                batch = batches.insert(batches.end(), NodeBatch { pool, nullptr, {}, {}, nullptr });
+            if (asked[index] != nullptr)
+                CommandEncoder(batch->requests).encode<commands::Asking>();
+            batch->requests.append(requests, command.offset, command.size);
+            batch->commands.push_back(index);
+        }
+
+        // Every node gets its batch before any reply is read, so the nodes
+        // work on them at the same time and a round costs one round trip.
+        for (auto &batch : batches) {
+            try {
+                batch.connection = batch.pool->borrowConnection();
+                batch.connection->write(batch.requests);
+            } catch (...) {
+                batch.error = std::current_exception();
+            }
+        }
+
+        std::vector<size_t> next;
+        bool moved = false;
+        bool tryAgain = false;
+        for (auto &batch : batches) {
+            size_t read = 0;
+            try {
+                for (; !batch.error && read < batch.commands.size(); ++read) {
+                    auto index = batch.commands[read];
+                    if (std::exchange(asked[index], nullptr) != nullptr)
+                        batch.connection->excuteOnce<details::RawReply>();
+                    auto reply = batch.connection->excuteOnce<details::RawReply>();
+
+                    auto &command = commands[index];
+                    auto redirect = details::parseRedirect(reply.get());
+                    if (redirect.type == details::Redirect::None || round >= client_.configuration_.maxRedirects) {
+                        command.resolve(*command.reply, reply.release());
+                        continue;
+                    }
+                    try {
+                        switch (redirect.type) {
+                        case details::Redirect::Moved:
+                            client_.moved(redirect);
+                            moved = true;
+                            break;
+                        case details::Redirect::Ask:
+                            asked[index] = client_.poolOf(redirect.host, redirect.port);
+                            break;
+                        default:
+                            tryAgain = true;
+                            break;
+                        }
+                        next.push_back(index);
+                    } catch (...) {
+                        // The node redirected to is out of reach.
+                        fail(index, std::current_exception());
+                    }
+                }
+            } catch (...) {
+                batch.error = std::current_exception();
+            }
+            if (batch.error) {
+                for (; read < batch.commands.size(); ++read)
+                    fail(batch.commands[read], batch.error);
+            }
+        }
+
+        // Keeps a command queued after another for the same key behind it.
+        std::sort(next.begin(), next.end());
+        pending.swap(next);
+        if (moved)
+            client_.refreshSoon();
+        if (tryAgain)
+            std::this_thread::sleep_for(TryAgainDelay);
+    }
+
+    if (firstError) {
+        client_.refreshSoon();
+        std::rethrow_exception(firstError);
+    }
+}
+
+}
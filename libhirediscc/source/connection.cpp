@@ -3,17 +3,22 @@
 // More license information, please see LICENSE file in module root folder.
 //---------------------------------------------------------------------------------------------------------------------
 
+#ifdef _WIN32
 #include <WinSock2.h>
+#endif
 #include <hiredis.h>
 
 #include <hirediscc/exception.h>
 #include <hirediscc/reply.h>
 #include <hirediscc/connection.h>
+#include <hirediscc/iouring.h>
 
 namespace hirediscc {
 
 Context::Context(redisContext *context)
-    : context_(context) {
+    : context_(context)
+    , transport_(Transport::Socket)
+    , timeoutMs_(-1) {
 }
 
 Context::~Context() {
@@ -28,43 +33,84 @@ Context& operator<<(Context &context,
 }
 
 void Context::appendCommandWithArgs(CommandArgs const & args) {
-    std::vector<char const*> argv;
-    argv.reserve(args.count());
-
-    std::vector<size_t> argvlen;
-    argvlen.reserve(args.count());
-
-    for (auto const & itr : args) {
-        argv.push_back(itr.c_str());
-        argvlen.push_back(itr.size());
-    }
+    encodeCommand(args);
+}
 
-    auto ret = ::redisAppendCommandArgv(context_,
-        static_cast<int>(args.count()),
-        &argv[0], 
-        argvlen.data());
+void Context::enableKeepAlive() {
+    auto ret = ::redisEnableKeepAlive(context_);
     if (ret != REDIS_OK) {
         throw Exception(ret);
     }
 }
 
-void Context::appendCommand(CommandArgs const & args) {
-	for (auto &itr : args) {
-		auto ret = ::redisAppendCommand(context_, itr.c_str());
-		if (ret != REDIS_OK) {
-			throw Exception(ret);
-		}
-	}
+void Context::flush() {
+    if (obuf_.empty())
+        return;
+    try {
+        details::writeBuffer(context_, obuf_.data(), obuf_.size());
+    } catch (...) {
+        obuf_.clear();
+        throw;
+    }
+    obuf_.clear();
 }
 
-void Context::enableKeepAlive() {
-    auto ret = ::redisEnableKeepAlive(context_);
-    if (ret != REDIS_OK) {
-        throw Exception(ret);
+void Context::send() {
+    if (transport_ != Transport::IoUring || obuf_.empty()) {
+        flush();
+        return;
     }
+    bool sent;
+    try {
+        sent = details::exchangeIoUring(context_, obuf_.data(), obuf_.size(), timeoutMs_);
+    } catch (...) {
+        obuf_.clear();
+        throw;
+    }
+    if (sent)
+        obuf_.clear();
+    else
+        flush();
+}
+
+Transport Context::setTransport(Transport transport) {
+    if (transport == Transport::IoUring && !details::IoUring::isAvailable())
+        transport = Transport::Socket;
+    transport_ = transport;
+    return transport_;
+}
+
+void Context::excute(ReplyBuilder &builder) {
+    send();
+    details::excute(context_, builder);
+}
+
+void Context::write(char const *data, size_t size) {
+    flush();
+    details::writeBuffer(context_, data, size);
+}
+
+size_t Context::pump(char const *data, size_t size, bool wantRead, size_t *read) {
+    flush();
+    return details::pumpSocket(context_, data, size, wantRead, read, timeoutMs_);
+}
+
+size_t Context::pump(char const *data, size_t size, bool wantRead, int wakeFd) {
+    flush();
+    return details::pumpSocket(context_, data, size, wantRead, nullptr, -1, wakeFd);
 }
 
-Connection::Connection() {
+void Context::setTimeout(int timeout) {
+    timeoutMs_ = timeout * 1000;
+}
+
+void Context::read() {
+    flush();
+    details::readSocket(context_);
+}
+
+Connection::Connection()
+    : local_(false) {
 }
 
 Connection::~Connection() {
@@ -75,12 +121,53 @@ void Connection::connect(std::string const &host, uint16_t port, int timeout) {
 	struct timeval timeoutSetting;
 	timeoutSetting.tv_sec = timeout;
 	timeoutSetting.tv_usec = 0;
-	auto ctx = ::redisConnectWithTimeout(host.c_str(), port, timeoutSetting);
-	if (!ctx || ctx->err) {
-		throw Exception(ctx->err);
+	local_ = false;
+	open(::redisConnectWithTimeout(host.c_str(), port, timeoutSetting));
+	context_->enableKeepAlive();
+	context_->setTimeout(timeout);
+}
+
+void Connection::connect(UnixSocket const &socket, int timeout) {
+	struct timeval timeoutSetting;
+	timeoutSetting.tv_sec = timeout;
+	timeoutSetting.tv_usec = 0;
+	local_ = true;
+	open(::redisConnectUnixWithTimeout(socket.path.c_str(), timeoutSetting));
+	context_->setTimeout(timeout);
+}
+
+void Connection::connectNonBlock(std::string const &host, uint16_t port) {
+#ifdef _WIN32
+	// Non-blocking connects aren't wired up on Windows; connect right away.
+	connect(host, port);
+#else
+	local_ = false;
+	open(::redisConnectNonBlock(host.c_str(), port));
+#endif
+}
+
+void Connection::connectNonBlock(UnixSocket const &socket) {
+	local_ = true;
+	open(::redisConnectUnixNonBlock(socket.path.c_str()));
+}
+
+void Connection::open(redisContext *ctx) {
+	if (!ctx) {
+		throw Exception(REDIS_ERR_OOM);
+	}
+	if (ctx->err) {
+		auto err = ctx->err;
+		::redisFree(ctx);
+		throw Exception(err);
 	}
 	context_ = std::make_unique<Context>(ctx);
-	context_->enableKeepAlive();
+}
+
+void Connection::finishConnect(int timeout) {
+	details::finishConnect(context_->handle(), timeout);
+	if (!local_)
+		context_->enableKeepAlive();
+	context_->setTimeout(timeout);
 }
 
 void Connection::close() {
@@ -88,15 +175,26 @@ void Connection::close() {
 }
 
 std::string Connection::ping() {
-	return excuteCommandWithArgs<ReplyString>("PING").value();
+	return excuteCommand<ReplyString, commands::Ping>().value();
 }
 
 std::string Connection::setAuth(std::string const &password) {
-	return excuteCommandWithArgs<ReplyString>("AUTH", password).value();
+	return excuteCommand<ReplyString, commands::Auth>(password).value();
+}
+
+void Connection::write(std::string const &requests) {
+	context_->write(requests.data(), requests.size());
 }
 
-void Connection::appendCommand(CommandArgs const &args) {
-	context_->appendCommand(args);
+size_t Connection::waitReady(std::vector<Connection*> const &connections,
+	std::vector<char> const &wantWrite,
+	std::chrono::milliseconds timeout,
+	std::vector<char> &ready) {
+	std::vector<redisContext*> contexts;
+	contexts.reserve(connections.size());
+	for (auto connection : connections)
+		contexts.push_back(connection->context_->handle());
+	return details::pollSockets(contexts, wantWrite, static_cast<int>(timeout.count()), ready);
 }
 
 }
@@ -3,89 +3,647 @@
 // More license information, please see LICENSE file in module root folder.
 //---------------------------------------------------------------------------------------------------------------------
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <hiredis.h>
+
+#include <algorithm>
+#include <iterator>
+
 #include <hirediscc/exception.h>
+#include <hirediscc/reply.h>
 #include <hirediscc/connection.h>
 #include <hirediscc/connectionpool.h>
 
 namespace hirediscc {
 
+namespace {
+
+// Attempts made before a borrower parks; a connection handed back within a
+// few yields is then picked up without a context switch.
+uint32_t const BorrowSpinCount = 64;
+
+// How long a sweep waits for the PONGs before evicting the silent connections.
+std::chrono::milliseconds const HealthCheckTimeout(1000);
+
+// How long warm-up waits for the initial connections, AUTH included.
+std::chrono::seconds const WarmUpTimeout(Connection::DefaultTimeout);
+
+std::atomic<uint64_t> nextPoolId(1);
+
+struct StickyConnection {
+    // 0 while the slot is unused.
+    uint64_t pool;
+    uint64_t epoch;
+    // Expires with the pool.
+    std::weak_ptr<ConnectionPool*> owner;
+    ConnectionPtr connection;
+};
+
+// Indexed by the pools' slots. Destroyed on thread exit, which hands the
+// connections back to their pools.
+thread_local std::vector<StickyConnection> stickyConnections;
+
+// Slots of destroyed pools, reused before new ones are added.
+std::mutex slotMutex;
+std::vector<uint32_t> freeSlots;
+uint32_t slotCount = 0;
+
+uint32_t acquireSlot() {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    if (freeSlots.empty())
+        return slotCount++;
+    auto slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void releaseSlot(uint32_t slot) {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    freeSlots.push_back(slot);
+}
+
+// Closes the connections of pools destroyed since, rather than keeping them
+// open until the thread exits.
+void dropOrphans() {
+    for (auto &sticky : stickyConnections) {
+        if (sticky.pool != 0 && sticky.owner.expired())
+            sticky = StickyConnection {};
+    }
+}
+
+}
+
 ConnectionPool::ConnectionPool(Configuration configuration) 
     : configuration_(configuration)
+    , id_(nextPoolId++)
+    , slot_(acquireSlot())
     , stopped_(false)
-    , idleCount_(0)
+    , capacity_(0)
+    , epoch_(0)
     , this_(new ConnectionPool*(this))
     , poolConn_(configuration_.maxCapacity)
-    , aliveConn_(configuration_.maxCapacity) {
+    , waiters_(0)
+    , nextShard_(0)
+    , growRequested_(false)
+    , warming_(true)
+    , warmUpError_(REDIS_ERR_IO)
+    , opened_(0)
+    , stats_()
+    , grown_(0)
+    , shrunk_(0) {
 
-    uint32_t capacity = 0;
+    auto shards = std::max<uint32_t>(1, configuration_.shards);
+    auto limit = (configuration_.maxIdle + shards - 1) / shards;
+    // A shard holds about its share of maxIdle, more spills to the next; but
+    // any one of them must take every connection when the others are full,
+    // so each gets room for maxCapacity and never allocates afterwards.
+    for (uint32_t i = 0; i < shards; ++i)
+        shards_.push_back(std::make_unique<Shard>(configuration_.maxCapacity, limit));
 
-    for (uint32_t i = 0; i < configuration_.initCapacity; ++i) {
-        ConnectionPtr conn(allocate());
-        conn->connect(configuration_.host, configuration_.port);
-        poolConn_.try_enqueue(conn);
-        ++capacity;
+    thread_ = std::thread([this]() {
+        maintain();
+    });
+
+    auto threshold = configuration_.readyThreshold;
+    if (threshold == 0 || threshold > configuration_.initCapacity)
+        threshold = configuration_.initCapacity;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    warmedUp_.wait(lock, [&]() {
+        return !warming_ || opened_ >= threshold;
+    });
+    if (opened_ < threshold) {
+        auto error = warmUpError_;
+        stopped_ = true;
+        lock.unlock();
+        maintain_.notify_one();
+        thread_.join();
+        this_.reset();
+        releaseSlot(slot_);
+        throw Exception(error);
     }
+}
 
-    auto handler = [this, capacity]() mutable {
-        using namespace std::chrono;
-        using namespace std::this_thread;
+ConnectionPool::~ConnectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    maintain_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+    // Connections still queued are deleted rather than handed back to the
+    // pool being destroyed.
+    this_.reset();
+    releaseSlot(slot_);
+}
 
-        while (!stopped_) {
-            ConnectionPtr conn;
+ConnectionPtr ConnectionPool::borrowConnection() {
+    return borrowConnection(std::nullopt);
+}
 
-            if (!poolConn_.try_dequeue(conn)) {
-                if (capacity < configuration_.maxCapacity) {
-                    ConnectionPtr newConn(allocate());
-                    newConn->connect(configuration_.host, configuration_.port);
-                    poolConn_.try_enqueue(newConn);
-                    ++capacity;
-                } else {
-                    poolConn_.try_enqueue(conn);
-                }
-            } else {
-                try {
-                    //Trace("Ping connection!\n");
-                    if (conn->ping() == "PONG") {
-                        if (idleCount_ < configuration_.maxIdle) {
-                            ++idleCount_;
-                            aliveConn_.try_enqueue(conn);
-                        }
+ConnectionPtr ConnectionPool::borrowConnection(std::chrono::milliseconds timeout) {
+    auto conn = borrowConnection(Clock::now() + timeout);
+    if (conn == nullptr)
+        throw Exception(Exception::PoolTimeout);
+    return conn;
+}
+
+void ConnectionPool::returnConnection(ConnectionPtr conn) {
+    if (conn->isHealthy())
+        makeIdle(conn, Clock::now(), homeShard());
+    else
+        repair(conn, true);
+}
+
+Connection &ConnectionPool::threadConnection() {
+    if (slot_ < stickyConnections.size()) {
+        auto &sticky = stickyConnections[slot_];
+        if (sticky.pool == id_ && sticky.epoch == epoch_.load(std::memory_order_relaxed))
+            return *sticky.connection;
+    }
+    return stickConnection();
+}
+
+void ConnectionPool::releaseThreadConnection() {
+    dropOrphans();
+    if (slot_ < stickyConnections.size() && stickyConnections[slot_].pool == id_)
+        stickyConnections[slot_] = StickyConnection {};
+}
+
+// Hands back whatever the thread holds in this pool's slot, which belongs to
+// an earlier epoch or a destroyed pool, and borrows a fresh connection.
+Connection &ConnectionPool::stickConnection() {
+    dropOrphans();
+    if (slot_ >= stickyConnections.size())
+        stickyConnections.resize(slot_ + 1);
+    auto &sticky = stickyConnections[slot_];
+    // Returned first, so a full pool can hand it straight back.
+    sticky = StickyConnection {};
+    auto epoch = epoch_.load();
+    sticky = StickyConnection { id_, epoch, this_, borrowConnection() };
+    return *sticky.connection;
+}
+
+ConnectionPtr ConnectionPool::borrowConnection(std::optional<Clock::time_point> deadline) {
+    IdleConnection idle;
+    while (waitConnection(idle, deadline)) {
+        if (validate(idle))
+            return std::move(idle.connection);
+        repair(idle.connection, true);
+    }
+    return nullptr;
+}
+
+// The shard of the core the caller runs on, or a fixed one per thread
+// where the core isn't known.
+uint32_t ConnectionPool::homeShard() const noexcept {
+    auto count = static_cast<uint32_t>(shards_.size());
+    if (count == 1)
+        return 0;
+#ifdef __linux__
+    auto cpu = ::sched_getcpu();
+    if (cpu >= 0)
+        return static_cast<uint32_t>(cpu) % count;
+#endif
+    static std::atomic<uint32_t> threads(0);
+    thread_local uint32_t const thread = threads++;
+    return thread % count;
+}
+
+uint32_t ConnectionPool::idleCount() const noexcept {
+    uint32_t count = 0;
+    for (auto const &shard : shards_)
+        count += shard->count.load(std::memory_order_relaxed);
+    return count;
+}
+
+// Takes the newest connection of the home shard first, then steals from the
+// neighbours; empty shards are skipped without taking their lock.
+bool ConnectionPool::tryBorrow(IdleConnection &idle) {
+    auto count = shards_.size();
+    auto home = homeShard();
+    for (size_t i = 0; i < count; ++i) {
+        auto &shard = *shards_[(home + i) % count];
+        if (shard.count.load(std::memory_order_relaxed) == 0)
+            continue;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.idle.empty())
+            continue;
+        idle = std::move(shard.idle.back());
+        shard.idle.pop_back();
+        --shard.count;
+        return true;
+    }
+    return false;
+}
+
+bool ConnectionPool::waitConnection(IdleConnection &idle, std::optional<Clock::time_point> deadline) {
+    for (uint32_t i = 0; i < BorrowSpinCount; ++i) {
+        if (tryBorrow(idle))
+            return true;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Having to wait is the signal to grow.
+    if (!growRequested_ && capacity_ < configuration_.maxCapacity) {
+        growRequested_ = true;
+        maintain_.notify_one();
+    }
+    ++waiters_;
+    // Pairs with the fence in wakeBorrower(): either this borrower sees the
+    // connection made idle or wakeBorrower() sees the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto found = true;
+    while (!tryBorrow(idle)) {
+        if (!deadline) {
+            idle_.wait(lock);
+        } else if (idle_.wait_until(lock, *deadline) == std::cv_status::timeout) {
+            found = tryBorrow(idle);
+            break;
+        }
+    }
+    --waiters_;
+    return found;
+}
+
+// Connections that sat idle for a while may have been dropped by the server
+// or a middlebox; recently used ones are trusted as they are.
+bool ConnectionPool::validate(IdleConnection const &idle) {
+    if (Clock::now() - idle.since < std::chrono::milliseconds(configuration_.maxIdleTimeout))
+        return true;
+    try {
+        return idle.connection->ping() == "PONG";
+    } catch (Exception const &) {
+        return false;
+    }
+}
+
+// Puts conn on top of the idle list of shard, or of the next one below its
+// share of maxIdle. The shares only spread connections out: when all lists
+// are at their share, shard takes it anyway.
+void ConnectionPool::makeIdle(ConnectionPtr const &conn, Clock::time_point since, uint32_t shard) {
+    auto count = shards_.size();
+    auto target = shards_[shard % count].get();
+    for (size_t i = 0; i < count; ++i) {
+        auto &candidate = *shards_[(shard + i) % count];
+        if (candidate.count.load(std::memory_order_relaxed) < candidate.limit) {
+            target = &candidate;
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(target->mutex);
+        target->idle.push_back(IdleConnection { conn, since });
+        ++target->count;
+    }
+    wakeBorrower();
+}
+
+// Retires conn instead when enough are idle; the caller reports the shrink.
+void ConnectionPool::release(ConnectionPtr conn) {
+    if (idleCount() >= configuration_.maxIdle && capacity_ > configuration_.initCapacity) {
+        retire(conn);
+        return;
+    }
+    makeIdle(conn, Clock::now(), nextShard_++ % shards_.size());
+}
+
+// Only takes the lock when a borrower is parked, so returning a connection
+// touches nothing shared beyond its shard.
+void ConnectionPool::wakeBorrower() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.notify_one();
+}
+
+ConnectionPool::HealthStats ConnectionPool::healthStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    return stats_;
+}
+
+ConnectionPool::SizingStats ConnectionPool::sizingStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    return SizingStats { capacity_.load(), idleCount(), grown_, shrunk_ };
+}
+
+// Sweeps every maxIdleTimeout, and grows the pool as soon as a borrower
+// has to wait.
+void ConnectionPool::maintain() {
+    warmUp();
+
+    auto interval = std::chrono::milliseconds(configuration_.maxIdleTimeout);
+    auto nextSweep = Clock::now();
+    while (!stopped_) {
+        if (Clock::now() >= nextSweep) {
+            sweep();
+            //Trace("Connection pool: %d, alive: %d\n", capacity_, idleCount());
+            nextSweep = Clock::now() + interval;
+        }
+
+        bool growing;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            maintain_.wait_until(lock, nextSweep, [this]() {
+                return stopped_ || growRequested_;
+            });
+            growing = growRequested_;
+            growRequested_ = false;
+        }
+        if (growing && !stopped_)
+            grow();
+    }
+}
+
+void ConnectionPool::grow() {
+    auto from = capacity_.load();
+    if (from >= configuration_.maxCapacity)
+        return;
+    auto count = std::min(std::max<uint32_t>(1, configuration_.capacityIncrement),
+        configuration_.maxCapacity - from);
+    open(count);
+    // Net of any retired right away by release().
+    if (capacity_ > from)
+        report(ResizeEvent::Grow, from, capacity_ - from);
+}
+
+// Queues a broken connection for a sweep to reconnect. The queue has room
+// for maxCapacity, so it is only full if the pool has lost count; conn is
+// then retired rather than dropped while capacity_ still counts it. The
+// maintenance thread reports its net changes itself; other callers ask for
+// the shrink to be reported here.
+void ConnectionPool::repair(ConnectionPtr &conn, bool reportShrink) {
+    if (poolConn_.try_enqueue(conn))
+        return;
+    auto from = capacity_.load();
+    retire(conn);
+    if (reportShrink)
+        report(ResizeEvent::Shrink, from, 1);
+}
+
+// Closes an idle connection for good rather than handing it back.
+void ConnectionPool::retire(ConnectionPtr &conn) {
+    if (auto deleter = std::get_deleter<ConnectionPtrDeleter>(conn))
+        deleter->detach();
+    conn.reset();
+    --capacity_;
+}
+
+// Threads hand their sticky connections back on their next call, so those
+// are spread over the new capacity too.
+void ConnectionPool::report(ResizeEvent::Reason reason, uint32_t from, uint32_t count) {
+    ++epoch_;
+    ResizeEvent event { reason, from, capacity_.load(), idleCount() };
+    {
+        std::lock_guard<std::mutex> lock(statsMutex_);
+        if (reason == ResizeEvent::Grow)
+            grown_ += count;
+        else
+            shrunk_ += count;
+    }
+    if (configuration_.onResize) {
+        try {
+            configuration_.onResize(event);
+        } catch (...) { }
+    }
+}
+
+void ConnectionPool::warmUp() {
+    open(configuration_.initCapacity);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    warming_ = false;
+    warmedUp_.notify_all();
+}
+
+void ConnectionPool::open(uint32_t count) {
+    std::vector<ConnectionPtr> connections;
+    for (uint32_t i = 0; i < count; ++i) {
+        connections.emplace_back(allocate());
+        ++capacity_;
+    }
+    connect(std::move(connections));
+}
+
+// Connects closed connections concurrently: every connect is started without
+// blocking, AUTH is sent as soon as a socket is connected, and one poll over
+// all sockets drives them until they are up. Ready connections become idle
+// right away; the ones that fail or time out are left to the sweeps to
+// reconnect. Returns how many came up.
+uint32_t ConnectionPool::connect(std::vector<ConnectionPtr> connections) {
+    std::vector<ConnectionPtr> pending;
+    for (auto &conn : connections) {
+        try {
+            if (configuration_.unixSocket.empty())
+                conn->connectNonBlock(configuration_.host, configuration_.port);
+            else
+                conn->connectNonBlock(UnixSocket { configuration_.unixSocket });
+            pending.push_back(std::move(conn));
+        } catch (Exception const &e) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            warmUpError_ = e.error();
+            repair(conn, false);
+        }
+    }
+    uint32_t count = 0;
+
+    std::string auth;
+    if (!configuration_.password.empty())
+        CommandEncoder(auth).encode<commands::Auth>(configuration_.password);
+
+    std::vector<char> connecting(pending.size(), 1);
+    std::vector<Connection*> sockets;
+    std::vector<char> ready;
+    auto deadline = Clock::now() + WarmUpTimeout;
+
+    while (!pending.empty() && !stopped_) {
+        auto now = Clock::now();
+        if (now >= deadline)
+            break;
+
+        sockets.clear();
+        for (auto const &conn : pending)
+            sockets.push_back(conn.get());
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+            + std::chrono::milliseconds(1);
+        if (Connection::waitReady(sockets, connecting, wait, ready) == 0)
+            continue;
+
+        for (size_t i = pending.size(); i-- > 0; ) {
+            if (!ready[i])
+                continue;
+            auto &conn = pending[i];
+            auto up = false;
+            try {
+                if (connecting[i]) {
+                    conn->finishConnect();
+                    connecting[i] = 0;
+                    if (auth.empty()) {
+                        up = true;
                     } else {
-                        poolConn_.try_enqueue(conn);
+                        conn->write(auth);
+                        continue;
                     }
-                } catch (Exception const &e) {
-                    //Trace("Connection closed (reson:%s)\n", e.what());
-                    conn->close();
-                    conn->connect(configuration_.host, configuration_.port);
-                    poolConn_.try_enqueue(conn);
+                } else {
+                    conn->read();
+                    auto reply = conn->tryExcuteOnce<ReplyString>();
+                    if (!reply)
+                        continue;
+                    if (reply->isError())
+                        throw Exception(REDIS_ERR_OTHER);
+                    up = true;
                 }
+            } catch (Exception const &e) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                warmUpError_ = e.error();
             }
 
-            //Trace("Connection pool: %d, alive: %d\n", capacity, idleCount_);
-            sleep_for(milliseconds(configuration_.maxIdleTimeout));
+            if (up) {
+                ++count;
+                release(conn);
+            } else {
+                conn->close();
+                repair(conn, false);
+            }
+            pending.erase(pending.begin() + i);
+            connecting.erase(connecting.begin() + i);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (up)
+                    ++opened_;
+            }
+            warmedUp_.notify_all();
         }
-    };
+    }
 
-    thread_ = std::thread(handler);
+    for (auto &conn : pending) {
+        conn->close();
+        repair(conn, false);
+    }
+    return count;
 }
 
-ConnectionPool::~ConnectionPool() {
-    stopped_ = true;
-    if (thread_.joinable())
-        thread_.join();
-}
+// Checks every connection waiting in poolConn_ and every idle connection
+// unused for maxIdleTimeout at once: a PING is written to each, the replies
+// are collected with one poll over all sockets, and connections that fail or
+// stay silent are reconnected together in the same sweep.
+void ConnectionPool::sweep() {
+    auto start = Clock::now();
+    auto idleTimeout = std::chrono::milliseconds(configuration_.maxIdleTimeout);
+    HealthStats result {};
 
-ConnectionPtr ConnectionPool::borrowConnection() {
-    ConnectionPtr conn;
-    do {
-        aliveConn_.try_dequeue(conn);
-    } while (conn == nullptr);
-    --idleCount_;
-    return conn;
-}
+    std::vector<ConnectionPtr> candidates(configuration_.maxCapacity);
+    candidates.resize(poolConn_.try_dequeue_bulk(candidates.data(), candidates.size()));
 
-void ConnectionPool::returnConnection(ConnectionPtr conn) {
-    poolConn_.try_enqueue(conn);
+    // Idle lists have the oldest connections at the bottom, so each is taken
+    // up to a recent one. Connections unused for maxIdleTimeout are closed
+    // down to initCapacity, the others are checked.
+    auto from = capacity_.load();
+    std::vector<IdleConnection> expired;
+    for (auto &shard : shards_) {
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            auto end = std::find_if(shard->idle.begin(), shard->idle.end(), [&](IdleConnection const &idle) {
+                return start - idle.since < idleTimeout;
+            });
+            std::move(shard->idle.begin(), end, std::back_inserter(expired));
+            shard->count -= static_cast<uint32_t>(end - shard->idle.begin());
+            shard->idle.erase(shard->idle.begin(), end);
+        }
+        for (auto &idle : expired) {
+            if (capacity_ > configuration_.initCapacity)
+                retire(idle.connection);
+            else
+                candidates.push_back(std::move(idle.connection));
+        }
+        expired.clear();
+    }
+
+    std::string request;
+    CommandEncoder(request).encode<commands::Ping>();
+
+    std::vector<ConnectionPtr> probing;
+    std::vector<ConnectionPtr> healthy;
+    std::vector<ConnectionPtr> evicted;
+    for (auto &candidate : candidates) {
+        try {
+            // A connection given back mid-command can't be reused.
+            if (!candidate->isHealthy()) {
+                evicted.push_back(std::move(candidate));
+                continue;
+            }
+            candidate->write(request);
+            probing.push_back(std::move(candidate));
+        } catch (Exception const &) {
+            evicted.push_back(std::move(candidate));
+        }
+    }
+    result.checked = static_cast<uint32_t>(candidates.size());
+
+    std::vector<Connection*> sockets;
+    std::vector<char> readable;
+    auto deadline = Clock::now() + HealthCheckTimeout;
+    while (!probing.empty()) {
+        auto now = Clock::now();
+        if (now >= deadline)
+            break;
+
+        sockets.clear();
+        for (auto const &probe : probing)
+            sockets.push_back(probe.get());
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+            + std::chrono::milliseconds(1);
+        if (Connection::waitReadable(sockets, wait, readable) == 0)
+            continue;
+
+        for (size_t i = probing.size(); i-- > 0; ) {
+            if (!readable[i])
+                continue;
+            auto &probe = probing[i];
+            try {
+                probe->read();
+                auto reply = probe->tryExcuteOnce<ReplyString>();
+                if (!reply)
+                    continue;
+                if (reply->value() == "PONG")
+                    healthy.push_back(std::move(probe));
+                else
+                    evicted.push_back(std::move(probe));
+            } catch (Exception const &) {
+                evicted.push_back(std::move(probe));
+            }
+            probing.erase(probing.begin() + i);
+        }
+    }
+    for (auto &probe : probing)
+        evicted.push_back(std::move(probe));
+
+    result.healthy = static_cast<uint32_t>(healthy.size());
+    result.evicted = static_cast<uint32_t>(evicted.size());
+
+    for (auto &alive : healthy)
+        release(alive);
+
+    // The ones that don't come up are tried again on the next sweep.
+    for (auto &dead : evicted)
+        dead->close();
+    result.replaced = connect(std::move(evicted));
+
+    // Everything retired by this sweep, as one event.
+    if (capacity_ < from)
+        report(ResizeEvent::Shrink, from, from - capacity_);
+
+    result.sweepTime = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    result.sweeps = stats_.sweeps + 1;
+    result.totalEvicted = stats_.totalEvicted + result.evicted;
+    stats_ = result;
 }
 
 ConnectionPool::PoolablesConnectionPtr ConnectionPool::allocate() {
@@ -3,15 +3,201 @@
 // More license information, please see LICENSE file in module root folder.
 //---------------------------------------------------------------------------------------------------------------------
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <hiredis.h>
+extern "C" {
+#include <sds.h>
+}
 
 #include <hirediscc/exception.h>
+#include <hirediscc/arena.h>
 #include <hirediscc/details.h>
+#include <hirediscc/iouring.h>
+#include <hirediscc/replybuilder.h>
 
 namespace hirediscc {
 
 namespace details {
 
+namespace {
+
+// Reader callbacks forwarding to the ReplyBuilder in the task's privdata.
+// hiredis only needs a non-null object back, so the builder itself is
+// returned and freeObject has nothing to release.
+
+size_t depthOf(redisReadTask const *task) {
+    size_t depth = 0;
+    for (; task->parent != nullptr; task = task->parent)
+        ++depth;
+    return depth;
+}
+
+ReplyBuilder *builderOf(redisReadTask const *task) {
+    return static_cast<ReplyBuilder*>(task->privdata);
+}
+
+void *createString(redisReadTask const *task, char *str, size_t len) {
+    try {
+        builderOf(task)->onString(task->type, str, len, depthOf(task));
+    } catch (...) {
+        return nullptr;
+    }
+    return task->privdata;
+}
+
+void *createArray(redisReadTask const *task, int elements) {
+    try {
+        builderOf(task)->onArray(static_cast<size_t>(elements), depthOf(task));
+    } catch (...) {
+        return nullptr;
+    }
+    return task->privdata;
+}
+
+void *createInteger(redisReadTask const *task, PORT_LONGLONG value) {
+    try {
+        builderOf(task)->onInteger(value, depthOf(task));
+    } catch (...) {
+        return nullptr;
+    }
+    return task->privdata;
+}
+
+void *createNil(redisReadTask const *task) {
+    try {
+        builderOf(task)->onNull(depthOf(task));
+    } catch (...) {
+        return nullptr;
+    }
+    return task->privdata;
+}
+
+void freeObject(void *) {
+}
+
+redisReplyObjectFunctions builderFunctions = {
+    createString,
+    createArray,
+    createInteger,
+    createNil,
+    freeObject
+};
+
+// Reader callbacks building the usual redisReply tree, but out of the
+// ReplyArena in the task's privdata instead of one malloc per node.
+
+redisReply *createArenaReply(redisReadTask const *task, int type) {
+    auto arena = static_cast<ReplyArena*>(task->privdata);
+    auto r = static_cast<redisReply*>(arena->allocate(sizeof(redisReply), alignof(redisReply)));
+    std::memset(r, 0, sizeof(*r));
+    r->type = type;
+    if (task->parent != nullptr)
+        static_cast<redisReply*>(task->parent->obj)->element[task->idx] = r;
+    return r;
+}
+
+void *createArenaString(redisReadTask const *task, char *str, size_t len) {
+    try {
+        auto arena = static_cast<ReplyArena*>(task->privdata);
+        auto buf = static_cast<char*>(arena->allocate(len + 1, 1));
+        std::memcpy(buf, str, len);
+        buf[len] = '\0';
+        auto r = createArenaReply(task, task->type);
+        r->str = buf;
+        r->len = static_cast<int>(len);
+        return r;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *createArenaArray(redisReadTask const *task, int elements) {
+    try {
+        auto arena = static_cast<ReplyArena*>(task->privdata);
+        redisReply **element = nullptr;
+        if (elements > 0) {
+            element = static_cast<redisReply**>(arena->allocate(elements * sizeof(redisReply*), alignof(redisReply*)));
+            std::memset(element, 0, elements * sizeof(redisReply*));
+        }
+        auto r = createArenaReply(task, REDIS_REPLY_ARRAY);
+        r->element = element;
+        r->elements = elements;
+        return r;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *createArenaInteger(redisReadTask const *task, PORT_LONGLONG value) {
+    try {
+        auto r = createArenaReply(task, REDIS_REPLY_INTEGER);
+        r->integer = value;
+        return r;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *createArenaNil(redisReadTask const *task) {
+    try {
+        return createArenaReply(task, REDIS_REPLY_NIL);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+redisReplyObjectFunctions arenaFunctions = {
+    createArenaString,
+    createArenaArray,
+    createArenaInteger,
+    createArenaNil,
+    freeObject
+};
+
+// hiredis' async contexts free every reply once its callback returns. The
+// reply detached by the callback is spared, so it can be handed on to a
+// future that outlives the callback.
+
+thread_local void *detachedReply = nullptr;
+
+void freeUndetached(void *reply) {
+    if (reply == detachedReply) {
+        detachedReply = nullptr;
+        return;
+    }
+    ::freeReplyObject(reply);
+}
+
+void *getReply(redisContext *context, redisReplyObjectFunctions *functions, void *privdata) {
+    auto reader = context->reader;
+    auto fn = reader->fn;
+    auto previous = reader->privdata;
+
+    reader->fn = functions;
+    reader->privdata = privdata;
+    void *r = nullptr;
+    auto ret = ::redisGetReply(context, &r);
+    reader->fn = fn;
+    reader->privdata = previous;
+
+    if (ret != REDIS_OK) {
+        throw Exception(context->err);
+    }
+    return r;
+}
+
+}
+
 void deleteRedisReply(redisReply * reply) {
     if (reply != nullptr)
         ::freeReplyObject(reply);
@@ -25,6 +211,10 @@ void deserializeRedisReply(redisReply * reply, std::string &result) {
     result.assign(reply->str, reply->len);
 }
 
+void deserializeRedisReply(redisReply * reply, std::string_view &result) {
+    result = std::string_view(reply->str, reply->len);
+}
+
 void deserializeRedisReply(redisReply * reply, int64_t &result) {
     result = reply->integer;
 }
@@ -35,6 +225,318 @@ void deserializeRedisReply(redisReply * reply, std::vector<redisReply*> &result)
         result.push_back(reply->element[i]);
 }
 
+void writeBuffer(redisContext *context, char const *data, size_t size) {
+    if (context->err)
+        throw Exception(context->err);
+#ifndef _WIN32
+    // Commands queued through hiredis itself must go out first.
+    if (sdslen(context->obuf) == 0) {
+        while (size > 0) {
+            auto written = ::write(context->fd, data, size);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                context->err = REDIS_ERR_IO;
+                std::snprintf(context->errstr, sizeof(context->errstr), "%s", std::strerror(errno));
+                throw Exception(REDIS_ERR_IO);
+            }
+            data += written;
+            size -= written;
+        }
+        return;
+    }
+#endif
+    context->obuf = ::sdscatlen(context->obuf, data, size);
+    if (context->obuf == nullptr) {
+        context->err = REDIS_ERR_OOM;
+        throw Exception(REDIS_ERR_OOM);
+    }
+}
+
+// With a wakeFd, also returns once that is readable, after draining it.
+size_t pumpSocket(redisContext *context, char const *data, size_t size, bool wantRead, size_t *read, int timeoutMs, int wakeFd) {
+    if (context->err)
+        throw Exception(context->err);
+    if (read != nullptr)
+        *read = 0;
+#ifndef _WIN32
+    pollfd pfds[2];
+    auto &pfd = pfds[0];
+    pfd.fd = context->fd;
+    pfd.events = static_cast<short>((size > 0 ? POLLOUT : 0) | (wantRead ? POLLIN : 0));
+    pfd.revents = 0;
+    pfds[1].fd = wakeFd;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+
+    int ret;
+    do {
+        ret = ::poll(pfds, wakeFd == -1 ? 1 : 2, timeoutMs);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        context->err = REDIS_ERR_IO;
+        std::snprintf(context->errstr, sizeof(context->errstr), "%s", std::strerror(errno));
+        throw Exception(REDIS_ERR_IO);
+    }
+    if (ret == 0) {
+        // Replies may still come; the connection is out of step for good.
+        context->err = REDIS_ERR_IO;
+        std::snprintf(context->errstr, sizeof(context->errstr), "Timed out");
+        throw Exception(Exception::Timeout);
+    }
+    if (pfds[1].revents & POLLIN) {
+        char buffer[64];
+        while (::read(wakeFd, buffer, sizeof(buffer)) > 0) {
+        }
+    }
+
+    size_t written = 0;
+    if (pfd.revents & POLLOUT) {
+        auto n = ::send(context->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            written = static_cast<size_t>(n);
+        } else if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            context->err = REDIS_ERR_IO;
+            std::snprintf(context->errstr, sizeof(context->errstr), "%s", std::strerror(errno));
+            throw Exception(REDIS_ERR_IO);
+        }
+    }
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+        auto buffered = context->reader->len;
+        if (::redisBufferRead(context) != REDIS_OK)
+            throw Exception(context->err);
+        if (read != nullptr)
+            *read = context->reader->len - buffered;
+    }
+    return written;
+#else
+    // No duplex path on Windows: send everything, then read what arrives,
+    // within the socket's own timeouts.
+    (void) timeoutMs;
+    (void) wakeFd;
+    writeBuffer(context, data, size);
+    if (wantRead) {
+        auto buffered = context->reader->len;
+        if (::redisBufferRead(context) != REDIS_OK)
+            throw Exception(context->err);
+        if (read != nullptr)
+            *read = context->reader->len - buffered;
+    }
+    return size;
+#endif
+}
+
+redisReply *pollReply(redisContext *context) {
+    void *reply = nullptr;
+    if (::redisGetReplyFromReader(context, &reply) != REDIS_OK)
+        throw Exception(context->err);
+    return static_cast<redisReply*>(reply);
+}
+
+void readSocket(redisContext *context) {
+    if (::redisBufferRead(context) != REDIS_OK)
+        throw Exception(context->err);
+}
+
+// Waits up to timeoutMs for the contexts to become ready: writable for those
+// flagged in wantWrite (e.g. still connecting), readable for the others.
+// ready[i] is set for each one that is ready, hung up or failed. Returns how
+// many were set.
+size_t pollSockets(std::vector<redisContext*> const &contexts,
+    std::vector<char> const &wantWrite,
+    int timeoutMs,
+    std::vector<char> &ready) {
+    ready.assign(contexts.size(), 0);
+#ifndef _WIN32
+    std::vector<pollfd> pfds(contexts.size());
+    for (size_t i = 0; i < contexts.size(); ++i) {
+        auto write = i < wantWrite.size() && wantWrite[i];
+        pfds[i].fd = contexts[i]->fd;
+        pfds[i].events = write ? POLLOUT : POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    int ret;
+    do {
+        ret = ::poll(pfds.data(), pfds.size(), timeoutMs);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0)
+        return 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < pfds.size(); ++i) {
+        if (pfds[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) {
+            ready[i] = 1;
+            ++count;
+        }
+    }
+    return count;
+#else
+    // No readiness polling on Windows: every socket is served in turn.
+    (void) wantWrite;
+    (void) timeoutMs;
+    ready.assign(contexts.size(), 1);
+    return contexts.size();
+#endif
+}
+
+// Sends data and receives the start of the answer with one io_uring_enter
+// on the thread's ring, instead of a write and a read: the receive is linked
+// behind the send and both completions are waited for together. What the
+// first receive leaves of the reply is read the usual way. Returns false,
+// with nothing sent, when io_uring can't be used. Like pumpSocket(), throws
+// Exception::Timeout when nothing comes within timeoutMs.
+bool exchangeIoUring(redisContext *context, char const *data, size_t size, int timeoutMs) {
+    if (context->err)
+        throw Exception(context->err);
+#ifdef HIREDISCC_HAS_IO_URING
+    using Clock = std::chrono::steady_clock;
+    auto ring = IoUring::forThread();
+    if (ring == nullptr || size == 0 || sdslen(context->obuf) != 0)
+        return false;
+    enum : uint64_t {
+        Send = 1,
+        Recv,
+        Cancel
+    };
+    thread_local char buffer[16 * 1024];
+    if (ring->space() < 2)
+        return false;
+    ring->send(context->fd, data, size, Send, true);
+    ring->recv(context->fd, buffer, sizeof(buffer), Recv);
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    bool sending = true;
+    bool receiving = true;
+    bool received = false;
+    bool cancelled = false;
+    bool timedOut = false;
+    bool eof = false;
+    int error = 0;
+    while (sending || receiving) {
+        auto wait = -1;
+        if (!cancelled && timeoutMs >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            wait = static_cast<int>(std::max<decltype(left)>(left, 0));
+        }
+        unsigned waitFor = (sending ? 1 : 0) + (receiving ? 1 : 0);
+        if (!ring->submit(waitFor, wait) && !cancelled)
+            timedOut = true;
+        IoUring::Completion completion;
+        while (ring->pop(completion)) {
+            if (completion.data == Send) {
+                sending = false;
+                if (completion.result < 0) {
+                    error = error != 0 ? error : -completion.result;
+                } else {
+                    data += completion.result;
+                    size -= completion.result;
+                }
+            } else if (completion.data == Recv) {
+                receiving = false;
+                if (completion.result > 0) {
+                    received = true;
+                    ::redisReaderFeed(context->reader, buffer, completion.result);
+                } else if (completion.result == 0) {
+                    eof = true;
+                } else if (completion.result != -ECANCELED && error == 0) {
+                    error = -completion.result;
+                }
+            }
+        }
+        auto failed = error != 0 || eof || timedOut;
+        // A short send breaks the link; the rest goes out with a new receive.
+        if (!failed && !sending && !receiving && size > 0 && !received) {
+            if (ring->space() < 2) {
+                error = ENOBUFS;
+                break;
+            }
+            sending = ring->send(context->fd, data, size, Send, true);
+            receiving = ring->recv(context->fd, buffer, sizeof(buffer), Recv);
+        }
+        // The buffers must outlive whatever is still in flight.
+        if (failed && !cancelled && (sending || receiving)) {
+            cancelled = true;
+            if (sending)
+                ring->cancel(Send, Cancel);
+            if (receiving)
+                ring->cancel(Recv, Cancel);
+        }
+    }
+    if (error == 0 && !eof && !timedOut)
+        return true;
+
+    if (error == 0 && eof) {
+        context->err = REDIS_ERR_EOF;
+        std::snprintf(context->errstr, sizeof(context->errstr), "Server closed the connection");
+        throw Exception(REDIS_ERR_EOF);
+    }
+    context->err = REDIS_ERR_IO;
+    if (error == 0) {
+        // Replies may still come; the connection is out of step for good.
+        std::snprintf(context->errstr, sizeof(context->errstr), "Timed out");
+        throw Exception(Exception::Timeout);
+    }
+    std::snprintf(context->errstr, sizeof(context->errstr), "%s", std::strerror(error));
+    throw Exception(REDIS_ERR_IO);
+#else
+    (void) data;
+    (void) size;
+    (void) timeoutMs;
+    return false;
+#endif
+}
+
+// Completes a connect started by redisConnectNonBlock once the socket is
+// writable and switches the context to blocking I/O for the sync API.
+void finishConnect(redisContext *context, int timeout) {
+#ifndef _WIN32
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(context->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+        error = errno;
+    if (error == 0) {
+        auto flags = ::fcntl(context->fd, F_GETFL);
+        if (flags == -1 || ::fcntl(context->fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+            error = errno;
+    }
+    if (error != 0) {
+        context->err = REDIS_ERR_IO;
+        std::snprintf(context->errstr, sizeof(context->errstr), "%s", std::strerror(error));
+        throw Exception(REDIS_ERR_IO);
+    }
+#endif
+    context->flags |= REDIS_BLOCK;
+    struct timeval timeoutSetting;
+    timeoutSetting.tv_sec = timeout;
+    timeoutSetting.tv_usec = 0;
+    if (::redisSetTimeout(context, timeoutSetting) != REDIS_OK)
+        throw Exception(context->err);
+}
+
+void makeRepliesDetachable(redisContext *context) {
+    static redisReplyObjectFunctions functions = [context]() {
+        auto fn = *context->reader->fn;
+        fn.freeObject = freeUndetached;
+        return fn;
+    }();
+    context->reader->fn = &functions;
+}
+
+void detachReply(redisReply *reply) {
+    detachedReply = reply;
+}
+
+// No error, nothing left to send and no reply partially or wholly unread,
+// i.e. the next command's reply will be the next one read.
+bool isClean(redisContext *context) {
+    auto reader = context->reader;
+    return context->err == 0
+        && ::sdslen(context->obuf) == 0
+        && reader->pos == reader->len
+        && reader->ridx == -1;
+}
+
 redisReply * excute(redisContext * context) {
     redisReply *r = nullptr;
     auto ret = ::redisGetReply(context, reinterpret_cast<void**>(&r));
@@ -44,5 +546,13 @@ redisReply * excute(redisContext * context) {
     return r;
 }
 
+void excute(redisContext *context, ReplyBuilder &builder) {
+    getReply(context, &builderFunctions, &builder);
+}
+
+redisReply *excute(redisContext *context, ReplyArena &arena) {
+    return static_cast<redisReply*>(getReply(context, &arenaFunctions, &arena));
+}
+
 }
 }
@@ -5,6 +5,7 @@
 
 #include <hiredis.h>
 
+#include <string>
 #include <unordered_map>
 #include <hirediscc/exception.h>
 
@@ -14,7 +15,7 @@ Exception::Exception(int error)
     : error_(error){
 }
 
-char const * Exception::what() const {
+char const * Exception::what() const noexcept {
     static std::unordered_map<int, std::string> const lookupTable {
         { 
             REDIS_ERR_IO,
@@ -28,9 +29,20 @@ char const * Exception::what() const {
         {
             REDIS_ERR_OTHER, "Any other error."
         },
+        {
+            REDIS_ERR_OOM, "Out of memory."
+        },
         { 
             REDIS_ERR_PROTOCOL,
             "There was an error while parsing the protocol."
+        },
+        {
+            PoolTimeout,
+            "Timed out waiting for a connection from the pool."
+        },
+        {
+            Timeout,
+            "Timed out waiting for the server."
         }
     };
     auto itr = lookupTable.find(error_);
@@ -0,0 +1,313 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#ifdef HIREDISCC_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#include <hirediscc/iouring.h>
+
+namespace hirediscc {
+
+namespace details {
+
+#ifdef HIREDISCC_HAS_IO_URING
+
+namespace {
+
+int setup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int enter(int fd, unsigned submit, unsigned waitFor, unsigned flags, void const *arg, size_t argSize) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, arg, argSize));
+}
+
+// The kernel reads the tails we write and writes the heads we read.
+unsigned loadAcquire(unsigned const *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned *value, unsigned newValue) {
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+}
+
+IoUring::IoUring()
+    : fd_(-1)
+    , ring_(MAP_FAILED)
+    , ringSize_(0)
+    , sqes_(nullptr)
+    , sqesSize_(0)
+    , sqHead_(nullptr)
+    , sqTail_(nullptr)
+    , sqArray_(nullptr)
+    , sqMask_(0)
+    , sqEntries_(0)
+    , cqHead_(nullptr)
+    , cqTail_(nullptr)
+    , cqMask_(0)
+    , cqes_(nullptr)
+    , tail_(0)
+    , queued_(0) {
+}
+
+IoUring::~IoUring() {
+    if (sqes_ != nullptr)
+        ::munmap(sqes_, sqesSize_);
+    if (ring_ != MAP_FAILED)
+        ::munmap(ring_, ringSize_);
+    if (fd_ != -1)
+        ::close(fd_);
+}
+
+std::unique_ptr<IoUring> IoUring::create(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    std::unique_ptr<IoUring> ring(new IoUring());
+    ring->fd_ = setup(entries, &params);
+    if (ring->fd_ == -1)
+        return nullptr;
+    // Timed waits need EXT_ARG (5.11); with it come the single mapping and
+    // completions that are never dropped.
+    auto const required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required)
+        return nullptr;
+
+    ring->ringSize_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring->ring_ = ::mmap(nullptr, ring->ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd_, IORING_OFF_SQ_RING);
+    if (ring->ring_ == MAP_FAILED)
+        return nullptr;
+    ring->sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = ::mmap(nullptr, ring->sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return nullptr;
+    ring->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto base = static_cast<char*>(ring->ring_);
+    ring->sqHead_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    ring->sqTail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    ring->sqArray_ = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    ring->sqMask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    ring->sqEntries_ = params.sq_entries;
+    ring->cqHead_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    ring->cqTail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    ring->cqMask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    ring->tail_ = *ring->sqTail_;
+    return ring;
+}
+
+IoUring *IoUring::forThread() {
+    thread_local std::unique_ptr<IoUring> ring = create(64);
+    return ring.get();
+}
+
+bool IoUring::isAvailable() {
+    static bool const available = create(1) != nullptr;
+    return available;
+}
+
+unsigned IoUring::space() const {
+    return sqEntries_ - (tail_ - loadAcquire(sqHead_));
+}
+
+io_uring_sqe *IoUring::next() {
+    if (space() == 0)
+        return nullptr;
+    auto index = tail_ & sqMask_;
+    auto sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++tail_;
+    ++queued_;
+    return sqe;
+}
+
+bool IoUring::send(int fd, void const *data, size_t size, uint64_t userData, bool link) {
+    auto sqe = next();
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(std::min<size_t>(size, 1u << 30));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    if (link)
+        sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::recv(int fd, void *data, size_t size, uint64_t userData) {
+    auto sqe = next();
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::read(int fd, void *data, size_t size, uint64_t userData) {
+    auto sqe = next();
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(size);
+    // Not a seekable file: read from the current position.
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::pollOut(int fd, uint64_t userData) {
+    auto sqe = next();
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::cancel(uint64_t target, uint64_t userData) {
+    auto sqe = next();
+    if (sqe == nullptr)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::submit(unsigned waitFor, int timeoutMs) {
+    storeRelease(sqTail_, tail_);
+    if (waitFor > 0 && loadAcquire(cqTail_) - *cqHead_ >= waitFor)
+        waitFor = 0;
+    if (queued_ == 0 && waitFor == 0)
+        return true;
+
+    __kernel_timespec timeout;
+    io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    unsigned flags = 0;
+    if (waitFor > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeoutMs >= 0) {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<uint64_t>(&timeout);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+    }
+
+    for (;;) {
+        auto ret = enter(fd_, queued_, waitFor, flags,
+            (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr,
+            (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+        if (ret >= 0) {
+            queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(ret));
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        // ETIME is the timeout; EBUSY asks for completions to be reaped
+        // before more is submitted.
+        break;
+    }
+    return waitFor == 0 || loadAcquire(cqTail_) != *cqHead_;
+}
+
+bool IoUring::pop(Completion &completion) {
+    auto head = *cqHead_;
+    if (head == loadAcquire(cqTail_))
+        return false;
+    auto &cqe = cqes_[head & cqMask_];
+    completion.data = cqe.user_data;
+    completion.result = cqe.res;
+    storeRelease(cqHead_, head + 1);
+    return true;
+}
+
+#else
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+}
+
+std::unique_ptr<IoUring> IoUring::create(unsigned) {
+    return nullptr;
+}
+
+IoUring *IoUring::forThread() {
+    return nullptr;
+}
+
+bool IoUring::isAvailable() {
+    return false;
+}
+
+// Never called: no ring can be created.
+
+unsigned IoUring::space() const {
+    return 0;
+}
+
+bool IoUring::send(int, void const *, size_t, uint64_t, bool) {
+    return false;
+}
+
+bool IoUring::recv(int, void *, size_t, uint64_t) {
+    return false;
+}
+
+bool IoUring::read(int, void *, size_t, uint64_t) {
+    return false;
+}
+
+bool IoUring::pollOut(int, uint64_t) {
+    return false;
+}
+
+bool IoUring::cancel(uint64_t, uint64_t) {
+    return false;
+}
+
+bool IoUring::submit(unsigned, int) {
+    return false;
+}
+
+bool IoUring::pop(Completion &) {
+    return false;
+}
+
+#endif
+
+}
+
+}
@@ -0,0 +1,149 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <cassert>
+#include <cerrno>
+#include <hiredis.h>
+
+#include <hirediscc/exception.h>
+#include <hirediscc/connection.h>
+#include <hirediscc/multiplexed.h>
+
+namespace hirediscc {
+
+MultiplexedConnection::MultiplexedConnection(std::string const &host,
+    uint16_t port,
+    std::string const &password,
+    uint32_t timeout)
+    : connection_(std::make_shared<Connection>())
+    , stopped_(false)
+    , polling_(false)
+    , wakePipe_{ -1, -1 }
+    , commands_(0)
+    , writes_(0) {
+    connection_->connect(host, port, timeout);
+    if (!password.empty())
+        connection_->setAuth(password);
+    start();
+}
+
+MultiplexedConnection::MultiplexedConnection(ConnectionPtr conn)
+    : connection_(conn)
+    , stopped_(false)
+    , polling_(false)
+    , wakePipe_{ -1, -1 }
+    , commands_(0)
+    , writes_(0) {
+    assert(conn != nullptr);
+    start();
+}
+
+MultiplexedConnection::~MultiplexedConnection() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_one();
+    wake();
+    if (thread_.joinable())
+        thread_.join();
+#ifndef _WIN32
+    ::close(wakePipe_[0]);
+    ::close(wakePipe_[1]);
+#endif
+}
+
+void MultiplexedConnection::start() {
+#ifndef _WIN32
+    if (::pipe(wakePipe_) == -1)
+        throw Exception(REDIS_ERR_IO);
+    for (auto fd : wakePipe_)
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+    thread_ = std::thread([this]() {
+        run();
+    });
+}
+
+void MultiplexedConnection::wake() {
+#ifndef _WIN32
+    char signal = 0;
+    while (::write(wakePipe_[1], &signal, 1) == -1 && errno == EINTR) {
+    }
+#endif
+}
+
+void MultiplexedConnection::run() {
+    std::string requests;
+    size_t offset = 0;
+    std::deque<std::unique_ptr<details::MultiplexedWaiter>> inFlight;
+
+    for (;;) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            polling_ = false;
+            wakeup_.wait(lock, [&]() {
+                return stopped_ || !pending_.empty() || !inFlight.empty();
+            });
+            if (pending_.empty() && inFlight.empty())
+                return;
+            stopping = stopped_;
+            polling_ = true;
+            // Take everything queued since the last write; the waiters
+            // follow their requests so replies stay matched in order.
+            if (offset == requests.size()) {
+                requests.clear();
+                offset = 0;
+                requests.swap(pending_);
+            } else {
+                requests.append(pending_);
+                pending_.clear();
+            }
+            for (auto &waiter : waiters_)
+                inFlight.push_back(std::move(waiter));
+            waiters_.clear();
+        }
+
+        try {
+            while (!inFlight.empty() && inFlight.front()->tryResolve(*connection_))
+                inFlight.pop_front();
+            auto size = requests.size() - offset;
+            if (size == 0 && inFlight.empty())
+                continue;
+            // Until stopped, the wait ends with the reply or the next command
+            // however slow the server is; then the connection's timeout
+            // bounds it, so a silent server cannot hold the destructor.
+            auto written = stopping
+                ? connection_->pump(requests.data() + offset, size, !inFlight.empty())
+                : connection_->pump(requests.data() + offset, size, !inFlight.empty(), wakePipe_[0]);
+            if (written > 0)
+                ++writes_;
+            offset += written;
+        } catch (...) {
+            fail(std::current_exception(), inFlight);
+            return;
+        }
+    }
+}
+
+void MultiplexedConnection::fail(std::exception_ptr error,
+    std::deque<std::unique_ptr<details::MultiplexedWaiter>> &inFlight) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = error;
+    for (auto &waiter : inFlight)
+        waiter->fail(error);
+    for (auto &waiter : waiters_)
+        waiter->fail(error);
+    inFlight.clear();
+    waiters_.clear();
+    pending_.clear();
+}
+
+}
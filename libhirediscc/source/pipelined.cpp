@@ -0,0 +1,43 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <hirediscc/reply.h>
+#include <hirediscc/pipelined.h>
+
+namespace hirediscc {
+
+Pipelined::Pipelined(ConnectionPtr conn, bool useArena)
+	: connection_(conn) {
+	if (useArena)
+		arena_ = std::make_shared<ReplyArena>();
+}
+
+void Pipelined::excute() {
+	if (arena_) {
+		if (arena_.use_count() > 1)
+			arena_ = std::make_shared<ReplyArena>();
+		else
+			arena_->reset();
+	}
+
+	auto slots = std::move(slots_);
+	slots_.clear();
+
+	size_t resolved = 0;
+	try {
+		connection_->write(requests_);
+		requests_.clear();
+		for (; resolved < slots.size(); ++resolved)
+			slots[resolved]->resolve(*connection_, arena_);
+	} catch (...) {
+		requests_.clear();
+		auto error = std::current_exception();
+		for (; resolved < slots.size(); ++resolved)
+			slots[resolved]->fail(error);
+		throw;
+	}
+}
+
+}
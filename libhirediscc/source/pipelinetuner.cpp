@@ -0,0 +1,148 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+
+#include <hirediscc/pipelinetuner.h>
+
+namespace hirediscc {
+
+namespace {
+
+size_t const InitialWindow = 64;
+size_t const MinFlushSize = 16 * 1024;
+size_t const MaxFlushSize = 256 * 1024;
+
+// Weight left to the samples of earlier intervals at every retune.
+double const FitDecay = 0.875;
+
+double smooth(double average, double sample, double weight) {
+    return average == 0 ? sample : average + (sample - average) * weight;
+}
+
+}
+
+PipelineTuner::PipelineTuner(size_t minWindow, size_t maxWindow, size_t maxInFlightBytes)
+    : minWindow_(std::max<size_t>(1, minWindow))
+    , maxWindow_(std::max(minWindow_, maxWindow))
+    , maxInFlightBytes_(maxInFlightBytes)
+    , window_(std::min(std::max(InitialWindow, minWindow_), maxWindow_))
+    , flushSize_(MinFlushSize)
+    , probing_(false)
+    , probeSequence_(0)
+    , probeAhead_(0)
+    , delivered_(0)
+    , fit_ {}
+    , rtt_(0)
+    , serverMicros_(0)
+    , intervalStart_(Clock::now())
+    , intervalReplies_(0)
+    , intervalBytes_(0)
+    , repliesPerSecond_(0)
+    , bytesPerRequest_(0)
+    , bytesPerReply_(0) {
+}
+
+PipelineTuner::Metrics PipelineTuner::metrics() const noexcept {
+    return Metrics {
+        window_,
+        flushSize_,
+        rtt_,
+        serverMicros_,
+        repliesPerSecond_,
+        bytesPerRequest_,
+        bytesPerReply_
+    };
+}
+
+void PipelineTuner::onRequest(size_t bytes) noexcept {
+    bytesPerRequest_ = smooth(bytesPerRequest_, static_cast<double>(bytes), 1.0 / 64);
+}
+
+void PipelineTuner::onFlushed(uint64_t sequence) noexcept {
+    if (probing_)
+        return;
+    probing_ = true;
+    probeSequence_ = sequence;
+    probeAhead_ = sequence - delivered_ - 1;
+    probeStart_ = Clock::now();
+}
+
+void PipelineTuner::onRead(size_t bytes) noexcept {
+    intervalBytes_ += bytes;
+}
+
+void PipelineTuner::onReply(uint64_t sequence) noexcept {
+    ++intervalReplies_;
+    delivered_ = sequence;
+
+    if (probing_ && sequence >= probeSequence_) {
+        auto micros = std::chrono::duration<double, std::micro>(Clock::now() - probeStart_).count();
+        auto ahead = static_cast<double>(probeAhead_);
+        fit_.n += 1;
+        fit_.ahead += ahead;
+        fit_.micros += micros;
+        fit_.ahead2 += ahead * ahead;
+        fit_.aheadMicros += ahead * micros;
+        if (rtt_ == 0)
+            rtt_ = micros;
+        probing_ = false;
+    }
+
+    // Replies come in bursts, so the rate is taken over a round trip at
+    // least.
+    if (intervalReplies_ >= window_
+        && Clock::now() - intervalStart_ >= std::chrono::duration<double, std::micro>(rtt_))
+        retune();
+}
+
+void PipelineTuner::retune() noexcept {
+    auto now = Clock::now();
+    auto elapsed = std::chrono::duration<double>(now - intervalStart_).count();
+
+    if (elapsed > 0)
+        repliesPerSecond_ = smooth(repliesPerSecond_, intervalReplies_ / elapsed, 0.25);
+    bytesPerReply_ = smooth(bytesPerReply_,
+        static_cast<double>(intervalBytes_) / intervalReplies_, 0.25);
+
+    intervalStart_ = now;
+    intervalReplies_ = 0;
+    intervalBytes_ = 0;
+
+    if (fit_.n >= 2) {
+        auto ahead = fit_.ahead / fit_.n;
+        auto micros = fit_.micros / fit_.n;
+        auto variance = fit_.ahead2 / fit_.n - ahead * ahead;
+        // With the samples all at about the same depth the slope is noise;
+        // the last server time is kept. The server cannot take longer per
+        // request than the replies are apart.
+        if (variance >= 1 && repliesPerSecond_ > 0) {
+            auto slope = (fit_.aheadMicros / fit_.n - ahead * micros) / variance;
+            serverMicros_ = std::min(std::max(slope, 0.0), 1e6 / repliesPerSecond_);
+        }
+        rtt_ = std::max(micros - serverMicros_ * ahead, micros / (ahead + 1));
+    }
+    fit_.n *= FitDecay;
+    fit_.ahead *= FitDecay;
+    fit_.micros *= FitDecay;
+    fit_.ahead2 *= FitDecay;
+    fit_.aheadMicros *= FitDecay;
+
+    if (rtt_ > 0 && repliesPerSecond_ > 0) {
+        auto target = 2 * repliesPerSecond_ * rtt_ / 1e6;
+        // At least a minimal flush in flight, so writes stay batched however
+        // short the round trip.
+        if (bytesPerRequest_ > 0)
+            target = std::max(target, MinFlushSize / bytesPerRequest_);
+        if (bytesPerReply_ > 0)
+            target = std::min(target, maxInFlightBytes_ / bytesPerReply_);
+        window_ = std::min(std::max(static_cast<size_t>(target), minWindow_), maxWindow_);
+    }
+
+    auto flushSize = static_cast<size_t>(window_ * bytesPerRequest_ / 4);
+    flushSize_ = std::min(std::max(flushSize, MinFlushSize), MaxFlushSize);
+}
+
+}
@@ -0,0 +1,538 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <hiredis.h>
+#include <async.h>
+extern "C" {
+#include <sds.h>
+}
+
+#include <hirediscc/exception.h>
+#include <hirediscc/asyncclient.h>
+#include <hirediscc/reactor.h>
+
+namespace hirediscc {
+
+namespace {
+
+thread_local Reactor const *currentReactor = nullptr;
+
+// Ready sockets taken from epoll per turn; the rest wait for the next one.
+int const MaxEvents = 256;
+
+// The io_uring user data: a Channel pointer tagged with the operation in its
+// low bits, or one of the two values below.
+enum : uint64_t {
+    Recv = 1,
+    Send = 2,
+    Poll = 3,
+    OperationMask = 3,
+    WakeData = 0,
+    CancelData = ~uint64_t(0)
+};
+
+}
+
+struct Reactor::Channel {
+    // Null once the connection is closed.
+    AsyncConnection *connection;
+    // The output buffer taken over by the send in flight.
+    sds sending;
+    bool receiving;
+    bool polling;
+    char buffer[16 * 1024];
+
+    bool idle() const noexcept {
+        return sending == nullptr && !receiving && !polling;
+    }
+
+    uint64_t data(uint64_t operation) const noexcept {
+        return reinterpret_cast<uint64_t>(this) | operation;
+    }
+};
+
+Reactor::Reactor(size_t ringCapacity, Transport transport)
+    : ring_(ringCapacity)
+    , connections_(0)
+    , reap_(false)
+    , wakeup_{ -1, -1 }
+    , sleeping_(false)
+    , epoll_(-1)
+    , orphans_(0)
+    , waking_(false) {
+    if (transport == Transport::IoUring)
+        uring_ = details::IoUring::create(static_cast<unsigned>(std::min<size_t>(ringCapacity, DefaultRingCapacity)));
+#ifndef _WIN32
+    if (::pipe(wakeup_) == -1)
+        throw Exception(REDIS_ERR_IO);
+    for (auto fd : wakeup_) {
+        // The io_uring waits in a read on the pipe, which has to block.
+        if (uring_ != nullptr && fd == wakeup_[0])
+            continue;
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+#endif
+#ifdef __linux__
+    if (uring_ == nullptr) {
+        epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (epoll_ == -1 || ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_[0], &event) == -1) {
+            if (epoll_ != -1)
+                ::close(epoll_);
+            ::close(wakeup_[0]);
+            ::close(wakeup_[1]);
+            throw Exception(REDIS_ERR_IO);
+        }
+    }
+#endif
+    thread_ = std::thread([this]() {
+        currentReactor = this;
+        run();
+    });
+}
+
+Reactor::~Reactor() {
+    schedule(Event::Stop, nullptr);
+    thread_.join();
+    // Ends the read still waiting on the pipe.
+    uring_.reset();
+#ifndef _WIN32
+    if (epoll_ != -1)
+        ::close(epoll_);
+    ::close(wakeup_[0]);
+    ::close(wakeup_[1]);
+#endif
+}
+
+bool Reactor::inLoop() const noexcept {
+    return currentReactor == this;
+}
+
+void Reactor::schedule(Event::Type type, AsyncConnection *connection) {
+    Event event { type, connection };
+    if (inLoop()) {
+        // The loop drains the ring before it sleeps again.
+        if (!ring_.try_enqueue(event))
+            overflow_.push_back(event);
+        return;
+    }
+    while (!ring_.try_enqueue(event)) {
+        wake();
+        std::this_thread::yield();
+    }
+    // Pairs with the fence in run(): either the reactor sees the event
+    // before it sleeps, or this sees it sleeping and wakes it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.exchange(false))
+        wake();
+}
+
+void Reactor::wake() {
+#ifndef _WIN32
+    char signal = 0;
+    while (::write(wakeup_[1], &signal, 1) == -1 && errno == EINTR) {
+    }
+#endif
+}
+
+void Reactor::run() {
+    bool stopping = false;
+    std::vector<Event> overflow;
+
+    for (;;) {
+        Event event;
+        while (ring_.try_dequeue(event))
+            dispatch(event, stopping);
+        while (!overflow_.empty()) {
+            overflow.swap(overflow_);
+            for (auto const &e : overflow)
+                dispatch(e, stopping);
+            overflow.clear();
+        }
+        reap();
+        if (stopping && attached_.empty() && orphans_ == 0)
+            return;
+
+        auto timeoutMs = pollTimeout();
+        if (reap_)
+            continue;
+
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring_.try_dequeue(event)) {
+            sleeping_.store(false);
+            dispatch(event, stopping);
+            continue;
+        }
+
+        // Only connections whose interest changed since the last turn are
+        // looked at, however many are attached.
+        for (auto connection : dirty_) {
+            connection->dirty_ = false;
+            update(connection);
+        }
+        dirty_.clear();
+        wait(timeoutMs);
+    }
+}
+
+// Sleeps until a socket is ready, the pipe is written to or timeoutMs has
+// passed, then serves what is ready.
+void Reactor::wait(int timeoutMs) {
+#ifndef _WIN32
+    if (uring_ != nullptr) {
+        if (!waking_) {
+            reserve(1);
+            waking_ = uring_->read(wakeup_[0], wakeBuffer_, sizeof(wakeBuffer_), WakeData);
+        }
+        uring_->submit(1, timeoutMs);
+        sleeping_.store(false);
+        details::IoUring::Completion completion;
+        while (uring_->pop(completion))
+            complete(completion.data, completion.result);
+        return;
+    }
+#endif
+#ifdef __linux__
+    epoll_event events[MaxEvents];
+    int ret;
+    do {
+        ret = ::epoll_wait(epoll_, events, MaxEvents, timeoutMs);
+    } while (ret == -1 && errno == EINTR);
+    sleeping_.store(false);
+
+    for (int i = 0; i < ret; ++i) {
+        auto connection = static_cast<AsyncConnection*>(events[i].data.ptr);
+        auto ready = events[i].events;
+        if (connection == nullptr) {
+            char buffer[64];
+            while (::read(wakeup_[0], buffer, sizeof(buffer)) > 0) {
+            }
+            continue;
+        }
+        auto failed = (ready & (EPOLLHUP | EPOLLERR)) != 0;
+        connection->handle(failed || (ready & EPOLLIN) != 0,
+            failed || (ready & EPOLLOUT) != 0,
+            failed);
+    }
+#elif !defined(_WIN32)
+    // No epoll: every attached socket goes to poll().
+    std::vector<pollfd> pfds(attached_.size() + 1);
+    pfds[0].fd = wakeup_[0];
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    for (size_t i = 0; i < attached_.size(); ++i) {
+        auto connection = attached_[i];
+        pfds[i + 1].fd = connection->context_->c.fd;
+        pfds[i + 1].events = static_cast<short>((connection->reading_ ? POLLIN : 0)
+            | (connection->writing_ ? POLLOUT : 0));
+        pfds[i + 1].revents = 0;
+    }
+
+    int ret;
+    do {
+        ret = ::poll(pfds.data(), pfds.size(), timeoutMs);
+    } while (ret == -1 && errno == EINTR);
+    sleeping_.store(false);
+    if (ret <= 0)
+        return;
+
+    if (pfds[0].revents & POLLIN) {
+        char buffer[64];
+        while (::read(wakeup_[0], buffer, sizeof(buffer)) > 0) {
+        }
+    }
+    for (size_t i = 0; i < attached_.size(); ++i) {
+        auto events = pfds[i + 1].revents;
+        if (events == 0)
+            continue;
+        auto failed = (events & (POLLHUP | POLLERR)) != 0;
+        attached_[i]->handle(failed || (events & POLLIN) != 0,
+            failed || (events & POLLOUT) != 0,
+            failed);
+    }
+#else
+    // No readiness polling on Windows: every socket is served each tick.
+    (void) timeoutMs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sleeping_.store(false);
+    for (auto connection : attached_)
+        connection->handle(true, true, false);
+#endif
+}
+
+void Reactor::touch(AsyncConnection *connection) {
+    if (connection->dirty_)
+        return;
+    connection->dirty_ = true;
+    dirty_.push_back(connection);
+}
+
+// Hands the connection's new interest to the kernel: the io_uring gets the
+// operations it now needs, epoll the events it now waits for.
+void Reactor::update(AsyncConnection *connection) {
+    if (uring_ != nullptr) {
+        arm(connection);
+        return;
+    }
+#ifdef __linux__
+    auto context = connection->context_;
+    if (context == nullptr)
+        return;
+    uint32_t events = (connection->reading_ ? uint32_t(EPOLLIN) : 0u) | (connection->writing_ ? uint32_t(EPOLLOUT) : 0u);
+    if (connection->watched_ && connection->events_ == events)
+        return;
+    epoll_event event {};
+    event.events = events;
+    event.data.ptr = connection;
+    if (::epoll_ctl(epoll_, connection->watched_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, context->c.fd, &event) == 0) {
+        connection->watched_ = true;
+        connection->events_ = events;
+    }
+#endif
+}
+
+void Reactor::dispatch(Event const &event, bool &stopping) {
+    switch (event.type) {
+    case Event::Attach:
+        attached_.push_back(event.connection);
+        connecting_.push_back(event.connection);
+        ++connections_;
+        if (uring_ != nullptr)
+            attach(event.connection);
+        event.connection->service();
+        touch(event.connection);
+        break;
+    case Event::Work:
+        event.connection->service();
+        touch(event.connection);
+        break;
+    case Event::Stop:
+        stopping = true;
+        break;
+    }
+}
+
+void Reactor::reap() {
+    if (!reap_)
+        return;
+    reap_ = false;
+    std::vector<AsyncConnection*> closed;
+    auto end = std::partition(attached_.begin(), attached_.end(), [](AsyncConnection *connection) {
+        return connection->context_ != nullptr;
+    });
+    closed.assign(end, attached_.end());
+    attached_.erase(end, attached_.end());
+    connections_ -= closed.size();
+    // The owner may destroy a closed connection at any time from now on.
+    auto open = [](AsyncConnection *connection) {
+        return connection->context_ != nullptr;
+    };
+    dirty_.erase(std::stable_partition(dirty_.begin(), dirty_.end(), open), dirty_.end());
+    connecting_.erase(std::stable_partition(connecting_.begin(), connecting_.end(), open), connecting_.end());
+    for (auto connection : closed) {
+        if (connection->channel_ != nullptr)
+            detach(connection);
+        connection->close();
+    }
+}
+
+int Reactor::pollTimeout() {
+    auto now = std::chrono::steady_clock::now();
+    auto next = std::chrono::steady_clock::time_point::max();
+    // Connections leave the list once connected or failed.
+    connecting_.erase(std::remove_if(connecting_.begin(), connecting_.end(), [&](AsyncConnection *connection) {
+        if (connection->connectDone_ || connection->expire(now))
+            return true;
+        next = std::min(next, connection->deadline_);
+        return false;
+    }), connecting_.end());
+    if (next == std::chrono::steady_clock::time_point::max())
+        return -1;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1;
+    return static_cast<int>(left);
+}
+
+void Reactor::attach(AsyncConnection *connection) {
+    auto channel = new Channel();
+    channel->connection = connection;
+    channel->sending = nullptr;
+    channel->receiving = false;
+    channel->polling = false;
+    connection->channel_ = channel;
+}
+
+void Reactor::detach(AsyncConnection *connection) {
+    auto channel = connection->channel_;
+    connection->channel_ = nullptr;
+    channel->connection = nullptr;
+    if (channel->idle()) {
+        delete channel;
+        return;
+    }
+    // The socket is closed, but an operation holds on to it until cancelled.
+    ++orphans_;
+    reserve(3);
+    if (channel->receiving)
+        uring_->cancel(channel->data(Recv), CancelData);
+    if (channel->sending != nullptr)
+        uring_->cancel(channel->data(Send), CancelData);
+    if (channel->polling)
+        uring_->cancel(channel->data(Poll), CancelData);
+}
+
+void Reactor::arm(AsyncConnection *connection) {
+    auto context = connection->context_;
+    auto channel = connection->channel_;
+    if (context == nullptr)
+        return;
+    auto fd = context->c.fd;
+    if (!(context->c.flags & REDIS_CONNECTED)) {
+        // Writable once connected.
+        if (!channel->polling) {
+            reserve(1);
+            channel->polling = uring_->pollOut(fd, channel->data(Poll));
+        }
+        return;
+    }
+    if (!channel->receiving && connection->reading_) {
+        reserve(1);
+        channel->receiving = uring_->recv(fd, channel->buffer, sizeof(channel->buffer), channel->data(Recv));
+    }
+    if (channel->sending == nullptr && ::sdslen(context->c.obuf) > 0) {
+        auto empty = ::sdsempty();
+        if (empty == nullptr)
+            return;
+        reserve(1);
+        channel->sending = context->c.obuf;
+        context->c.obuf = empty;
+        uring_->send(fd, channel->sending, ::sdslen(channel->sending), channel->data(Send));
+        ++connection->writes_;
+    }
+}
+
+void Reactor::complete(uint64_t data, int32_t result) {
+    if (data == CancelData)
+        return;
+    if (data == WakeData) {
+        waking_ = false;
+        return;
+    }
+    auto channel = reinterpret_cast<Channel*>(data & ~uint64_t(OperationMask));
+    auto connection = channel->connection;
+    auto context = connection != nullptr ? connection->context_ : nullptr;
+    auto fail = [&](int error, char const *message) {
+        // As when hiredis fails a read or write itself.
+        context->c.err = error;
+        std::snprintf(context->c.errstr, sizeof(context->c.errstr), "%s", message);
+        ::redisAsyncFree(context);
+    };
+
+    switch (data & OperationMask) {
+    case Recv:
+        channel->receiving = false;
+        if (context == nullptr || result == -ECANCELED)
+            break;
+        if (result > 0) {
+            if (::redisReaderFeed(context->c.reader, channel->buffer, result) != REDIS_OK) {
+                fail(REDIS_ERR_OOM, "Out of memory");
+                break;
+            }
+            ::redisProcessCallbacks(context);
+        } else if (result == 0) {
+            fail(REDIS_ERR_EOF, "Server closed the connection");
+        } else {
+            fail(REDIS_ERR_IO, std::strerror(-result));
+        }
+        break;
+    case Send: {
+        auto sent = channel->sending;
+        channel->sending = nullptr;
+        if (context == nullptr) {
+            ::sdsfree(sent);
+            break;
+        }
+        if (result < 0) {
+            ::sdsfree(sent);
+            fail(REDIS_ERR_IO, std::strerror(-result));
+            break;
+        }
+        if (static_cast<size_t>(result) == ::sdslen(sent)) {
+            ::sdsfree(sent);
+            break;
+        }
+        // What the socket did not take goes out first next time.
+        ::sdsrange(sent, result, -1);
+        auto obuf = ::sdscatsds(sent, context->c.obuf);
+        if (obuf == nullptr) {
+            ::sdsfree(sent);
+            fail(REDIS_ERR_OOM, "Out of memory");
+            break;
+        }
+        ::sdsfree(context->c.obuf);
+        context->c.obuf = obuf;
+        break;
+    }
+    case Poll:
+        channel->polling = false;
+        // Completes the connect and sends what was queued meanwhile.
+        if (context != nullptr && result != -ECANCELED)
+            ::redisAsyncHandleWrite(context);
+        break;
+    }
+
+    if (connection == nullptr && channel->idle()) {
+        delete channel;
+        --orphans_;
+    } else if (connection != nullptr) {
+        touch(connection);
+    }
+}
+
+void Reactor::reserve(unsigned entries) {
+    if (uring_->space() < entries)
+        uring_->submit();
+}
+
+IoEngine::IoEngine(size_t reactors, Executor executor, Transport transport)
+    : executor_(std::move(executor)) {
+    if (reactors == 0)
+        reactors = std::max(1u, std::thread::hardware_concurrency());
+    reactors_.reserve(reactors);
+    for (size_t i = 0; i < reactors; ++i)
+        reactors_.push_back(std::make_unique<Reactor>(Reactor::DefaultRingCapacity, transport));
+}
+
+std::unique_ptr<AsyncConnection> IoEngine::connect(std::string const &host,
+    uint16_t port,
+    std::string const &password,
+    uint32_t timeout) {
+    return std::make_unique<AsyncConnection>(leastLoaded(), host, port, password, timeout, executor_);
+}
+
+Reactor &IoEngine::leastLoaded() noexcept {
+    auto itr = std::min_element(reactors_.begin(), reactors_.end(),
+        [](std::unique_ptr<Reactor> const &a, std::unique_ptr<Reactor> const &b) {
+            return a->connections() < b->connections();
+        });
+    return **itr;
+}
+
+}
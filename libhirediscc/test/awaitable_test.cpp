@@ -0,0 +1,214 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <hirediscc/hirediscc.h>
+#include <hirediscc/awaitable.h>
+
+#include "check.h"
+
+#ifndef HIREDISCC_HAS_COROUTINES
+#error awaitable_test needs C++20 coroutines
+#endif
+
+namespace {
+
+// Answers PING with PONG and GET with "v"; DROP closes the connection.
+class FakeServer {
+public:
+	FakeServer()
+		: listener_(::socket(AF_INET, SOCK_STREAM, 0)) {
+		sockaddr_in address {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		CHECK(listener_ >= 0);
+		CHECK(::bind(listener_, reinterpret_cast<sockaddr *>(&address), length) == 0);
+		CHECK(::listen(listener_, 16) == 0);
+		CHECK(::getsockname(listener_, reinterpret_cast<sockaddr *>(&address), &length) == 0);
+		port_ = ntohs(address.sin_port);
+		thread_ = std::thread([this]() {
+			run();
+		});
+	}
+
+	~FakeServer() {
+		::shutdown(listener_, SHUT_RDWR);
+		::close(listener_);
+		thread_.join();
+	}
+
+	uint16_t port() const {
+		return port_;
+	}
+private:
+	void run() {
+		for (;;) {
+			int fd = ::accept(listener_, nullptr, nullptr);
+			if (fd < 0)
+				return;
+			serve(fd);
+			::close(fd);
+		}
+	}
+
+	// One client at a time is all the test needs.
+	static void serve(int fd) {
+		std::string input;
+		char buffer[4096];
+		for (;;) {
+			std::vector<std::string> command;
+			size_t used;
+			while ((used = parse(input, command)) == 0) {
+				auto n = ::read(fd, buffer, sizeof(buffer));
+				if (n <= 0)
+					return;
+				input.append(buffer, static_cast<size_t>(n));
+			}
+			input.erase(0, used);
+			std::string reply;
+			if (command[0] == "PING")
+				reply = "+PONG\r\n";
+			else if (command[0] == "GET")
+				reply = "$1\r\nv\r\n";
+			else if (command[0] == "DROP")
+				return;
+			else
+				reply = "+OK\r\n";
+			if (::write(fd, reply.data(), reply.size()) != static_cast<ssize_t>(reply.size()))
+				return;
+		}
+	}
+
+	// Returns the bytes taken by the first complete command, 0 if there is none yet.
+	static size_t parse(std::string const &input, std::vector<std::string> &command) {
+		command.clear();
+		auto line = [&](size_t &pos) -> long {
+			auto end = input.find("\r\n", pos);
+			if (end == std::string::npos)
+				return -1;
+			auto value = std::strtol(input.c_str() + pos + 1, nullptr, 10);
+			pos = end + 2;
+			return value;
+		};
+		size_t pos = 0;
+		auto count = line(pos);
+		for (long i = 0; i < count; ++i) {
+			auto size = line(pos);
+			if (size < 0 || input.size() < pos + size + 2)
+				return 0;
+			command.emplace_back(input, pos, size);
+			pos += size + 2;
+		}
+		return count > 0 ? pos : 0;
+	}
+
+	int listener_;
+	uint16_t port_;
+	std::thread thread_;
+};
+
+// Runs eagerly and reports its end through a future.
+struct Task {
+	struct promise_type {
+		std::promise<void> done;
+
+		Task get_return_object() {
+			return Task { done.get_future() };
+		}
+
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+
+		void return_void() {
+			done.set_value();
+		}
+
+		void unhandled_exception() {
+			done.set_exception(std::current_exception());
+		}
+	};
+
+	std::future<void> done;
+};
+
+// Fails to encode, after part of the command has gone to the buffer.
+struct Unencodable {
+	operator std::string_view() const {
+		throw std::runtime_error("unencodable");
+	}
+};
+
+Task exercise(hirediscc::AwaitableClient &client, std::atomic<int> &resumed) {
+	CHECK((co_await client.ping()).value() == "PONG");
+	CHECK((co_await client.get("k")).value() == "v");
+
+	// A throwing encode resumes the coroutine once, with its exception, and
+	// leaves nothing half written for the next command.
+	auto threw = false;
+	try {
+		co_await hirediscc::awaitCommand(client.connection(), "SET", "k", Unencodable {});
+	} catch (std::runtime_error const &) {
+		threw = true;
+	}
+	++resumed;
+	CHECK(threw);
+	CHECK((co_await client.ping()).value() == "PONG");
+
+	threw = false;
+	try {
+		co_await hirediscc::awaitCommand(client.connection(), "DROP");
+	} catch (hirediscc::Exception const &) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	// Later commands fail without suspending; a retry loop must neither
+	// recurse nor resume the coroutine twice.
+	int failed = 0;
+	for (int i = 0; i < 100000; ++i) {
+		try {
+			co_await client.ping();
+		} catch (hirediscc::Exception const &) {
+			++failed;
+		}
+	}
+	CHECK(failed == 100000);
+}
+
+}
+
+int main() {
+	FakeServer server;
+	std::atomic<int> resumed(0);
+	{
+		hirediscc::AwaitableClient client("127.0.0.1", server.port());
+		auto task = exercise(client, resumed);
+		CHECK(task.done.wait_for(std::chrono::seconds(30)) == std::future_status::ready);
+		task.done.get();
+	}
+	CHECK(resumed == 1);
+	return 0;
+}
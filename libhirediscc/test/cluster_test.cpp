@@ -0,0 +1,95 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <string>
+#include <hiredis.h>
+
+#include <hirediscc/cluster.h>
+
+#include "check.h"
+
+namespace {
+
+using hirediscc::keySlot;
+using hirediscc::details::Redirect;
+
+Redirect parse(char const *error, int type = REDIS_REPLY_ERROR) {
+    redisReply reply;
+    std::memset(&reply, 0, sizeof(reply));
+    reply.type = type;
+    reply.str = const_cast<char *>(error);
+    reply.len = std::strlen(error);
+    return hirediscc::details::parseRedirect(&reply);
+}
+
+// Slots as CLUSTER KEYSLOT reports them; the CRC16 is the XMODEM one.
+void testKeySlot() {
+    CHECK(keySlot("") == 0);
+    CHECK(keySlot("123456789") == 0x31c3);
+    CHECK(keySlot("foo") == 12182);
+    CHECK(keySlot("bar") == 5061);
+
+    // The hash tag is the text between the first { and the next }.
+    CHECK(keySlot("{user1000}.following") == keySlot("user1000"));
+    CHECK(keySlot("{user1000}.followers") == keySlot("{user1000}.following"));
+    CHECK(keySlot("foo{bar}zap") == keySlot("bar"));
+    CHECK(keySlot("{a}{b}") == keySlot("a"));
+    CHECK(keySlot("foo{{bar}}zap") == keySlot("{bar"));
+
+    // No tag, so the whole key is hashed.
+    CHECK(keySlot("{}") == 15257);
+    CHECK(keySlot("foo{}{bar}") == 8363);
+    CHECK(keySlot("foo{") == 7673);
+    CHECK(keySlot("foo}{bar") == 7624);
+    CHECK(keySlot("{}") != keySlot(""));
+}
+
+void testRedirect() {
+    auto moved = parse("MOVED 3999 127.0.0.1:6381");
+    CHECK(moved.type == Redirect::Moved);
+    CHECK(moved.slot == 3999);
+    CHECK(moved.host == "127.0.0.1");
+    CHECK(moved.port == 6381);
+
+    auto ask = parse("ASK 16383 ::1:7002");
+    CHECK(ask.type == Redirect::Ask);
+    CHECK(ask.slot == 16383);
+    CHECK(ask.host == "::1");
+    CHECK(ask.port == 7002);
+
+    CHECK(parse("TRYAGAIN Multiple keys request during rehashing of slot").type == Redirect::TryAgain);
+    CHECK(parse("TRYAGAIN").type == Redirect::TryAgain);
+
+    // Other errors, and other reply types, are no redirect.
+    CHECK(parse("ERR unknown command").type == Redirect::None);
+    CHECK(parse("MOVEDX 1 host:1").type == Redirect::None);
+    CHECK(parse("MOVED 1 host:1", REDIS_REPLY_STATUS).type == Redirect::None);
+    CHECK(hirediscc::details::parseRedirect(nullptr).type == Redirect::None);
+
+    // Malformed MOVED and ASK are left as error replies.
+    CHECK(parse("MOVED").type == Redirect::None);
+    CHECK(parse("MOVED 3999").type == Redirect::None);
+    CHECK(parse("MOVED x 127.0.0.1:6381").type == Redirect::None);
+    CHECK(parse("MOVED -1 127.0.0.1:6381").type == Redirect::None);
+    CHECK(parse("MOVED 16384 127.0.0.1:6381").type == Redirect::None);
+    CHECK(parse("MOVED 12ab 127.0.0.1:6381").type == Redirect::None);
+    CHECK(parse("MOVED  127.0.0.1:6381").type == Redirect::None);
+    CHECK(parse("MOVED 3999 127.0.0.1").type == Redirect::None);
+    CHECK(parse("MOVED 3999 :6381").type == Redirect::None);
+    CHECK(parse("MOVED 3999 127.0.0.1:").type == Redirect::None);
+    CHECK(parse("MOVED 3999 127.0.0.1:0").type == Redirect::None);
+    CHECK(parse("MOVED 3999 127.0.0.1:65536").type == Redirect::None);
+    CHECK(parse("MOVED 3999 127.0.0.1:63 81").type == Redirect::None);
+    CHECK(parse("ASK 3999 127.0.0.1:port").type == Redirect::None);
+}
+
+}
+
+int main() {
+    testKeySlot();
+    testRedirect();
+    return 0;
+}
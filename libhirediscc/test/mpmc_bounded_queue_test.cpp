@@ -0,0 +1,215 @@
+//---------------------------------------------------------------------------------------------------------------------
+// Copyright (c) 2016 libhirediscc project. All rights reserved.
+// More license information, please see LICENSE file in module root folder.
+//---------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <thread>
+#include <vector>
+
+#include <hirediscc/mpmc_bounded_queue.h>
+
+#include "check.h"
+
+namespace {
+
+size_t const Producers = 4;
+size_t const Consumers = 4;
+size_t const PerProducer = 200000;
+size_t const Batch = 7;
+
+// Item values are producer * PerProducer + index; Stop tells a consumer to quit.
+uint64_t const Stop = ~uint64_t(0);
+
+using Seen = std::vector<std::atomic<uint8_t>>;
+
+void record(Seen &seen, uint64_t value) {
+    CHECK(value < seen.size());
+    CHECK(seen[value].fetch_add(1, std::memory_order_relaxed) == 0);
+}
+
+// Records n dequeued items; returns true once a Stop was among them. A bulk
+// dequeue may take other consumers' Stops along, so those go back.
+template <typename Queue>
+bool consume(Queue &queue, Seen &seen, uint64_t const *items, size_t n) {
+    size_t stops = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (items[i] == Stop)
+            ++stops;
+        else
+            record(seen, items[i]);
+    }
+    for (size_t i = 1; i < stops; ++i) {
+        uint64_t again = Stop;
+        while (!queue.try_enqueue(again))
+            std::this_thread::yield();
+    }
+    return stops != 0;
+}
+
+template <typename Queue>
+void produceBulk(Queue &queue, size_t producer) {
+    uint64_t items[Batch];
+    size_t next = 0;
+    while (next < PerProducer) {
+        size_t count = std::min(Batch, PerProducer - next);
+        for (size_t i = 0; i != count; ++i)
+            items[i] = producer * PerProducer + next + i;
+        size_t done = 0;
+        while (done < count) {
+            size_t n = queue.try_enqueue_bulk(items + done, count - done);
+            if (n == 0)
+                std::this_thread::yield();
+            done += n;
+        }
+        next += count;
+    }
+}
+
+template <typename Queue>
+void stopConsumers(Queue &queue) {
+    for (size_t i = 0; i != Consumers; ++i) {
+        uint64_t stop = Stop;
+        while (!queue.try_enqueue(stop))
+            std::this_thread::yield();
+    }
+}
+
+// Bulk producers against bulk and single-item consumers, all spinning.
+void testBulk() {
+    mpmc_bounded_queue<uint64_t> queue(64);
+    Seen seen(Producers * PerProducer);
+    std::vector<std::thread> threads;
+
+    for (size_t c = 0; c != Consumers; ++c) {
+        threads.emplace_back([&, c]() {
+            uint64_t items[Batch];
+            for (;;) {
+                size_t n = c % 2 == 0
+                    ? queue.try_dequeue_bulk(items, Batch)
+                    : queue.try_dequeue(items[0]) ? 1 : 0;
+                if (n == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                if (consume(queue, seen, items, n))
+                    return;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p != Producers; ++p)
+        producers.emplace_back([&, p]() { produceBulk(queue, p); });
+    for (auto &producer : producers)
+        producer.join();
+    stopConsumers(queue);
+    for (auto &thread : threads)
+        thread.join();
+
+    for (auto &count : seen)
+        CHECK(count.load() == 1);
+    uint64_t left;
+    CHECK(!queue.try_dequeue(left));
+}
+
+// Producers against consumers parked in wait_dequeue and wait_dequeue_bulk;
+// a lost wakeup hangs the test.
+void testBlocking() {
+    mpmc_bounded_queue<uint64_t, true> queue(64);
+    Seen seen(Producers * PerProducer);
+    std::vector<std::thread> threads;
+
+    for (size_t c = 0; c != Consumers; ++c) {
+        threads.emplace_back([&, c]() {
+            uint64_t items[Batch];
+            for (;;) {
+                size_t n = 1;
+                if (c % 2 == 0)
+                    n = queue.wait_dequeue_bulk(items, Batch);
+                else
+                    queue.wait_dequeue(items[0]);
+                if (consume(queue, seen, items, n))
+                    return;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p != Producers; ++p) {
+        producers.emplace_back([&, p]() {
+            // Mix single enqueues in, and pause now and then so consumers park.
+            for (size_t i = 0; i != PerProducer; ++i) {
+                uint64_t item = p * PerProducer + i;
+                while (!queue.try_enqueue(item))
+                    std::this_thread::yield();
+                if (i % 4096 == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+    for (auto &producer : producers)
+        producer.join();
+    stopConsumers(queue);
+    for (auto &thread : threads)
+        thread.join();
+
+    for (auto &count : seen)
+        CHECK(count.load() == 1);
+}
+
+void testWaitUntil() {
+    using Clock = std::chrono::steady_clock;
+    mpmc_bounded_queue<uint64_t, true> queue(2);
+    uint64_t item = 0;
+
+    auto start = Clock::now();
+    CHECK(!queue.wait_dequeue_until(item, start + std::chrono::milliseconds(50)));
+    CHECK(Clock::now() - start >= std::chrono::milliseconds(50));
+
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t value = 42;
+        CHECK(queue.try_enqueue(value));
+    });
+    CHECK(queue.wait_dequeue_until(item, Clock::now() + std::chrono::seconds(10)));
+    CHECK(item == 42);
+    producer.join();
+}
+
+void testLayout() {
+    // Only blocking queues carry the eventcount.
+    static_assert(sizeof(mpmc_bounded_queue<uint64_t, true>)
+        >= sizeof(mpmc_bounded_queue<uint64_t>) + sizeof(eventcount), "eventcount missing");
+    static_assert(std::is_empty<mpmc_queue_waiters<false>>::value, "waiters not empty");
+
+    uint64_t items[4] = {1, 2, 3, 4};
+    mpmc_bounded_queue<uint64_t> queue(4);
+    CHECK(queue.try_enqueue_bulk(items, 4) == 4);
+    CHECK(queue.try_enqueue_bulk(items, 1) == 0);
+    uint64_t out[8] = {};
+    CHECK(queue.try_dequeue_bulk(out, 8) == 4);
+    CHECK(out[0] == 1 && out[3] == 4);
+    CHECK(queue.try_dequeue_bulk(out, 8) == 0);
+
+    bool threw = false;
+    try {
+        mpmc_bounded_queue<uint64_t> bad(3);
+    } catch (std::invalid_argument const &) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+}
+
+int main() {
+    testLayout();
+    testWaitUntil();
+    testBulk();
+    testBlocking();
+    return 0;
+}
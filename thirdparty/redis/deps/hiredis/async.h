@@ -119,12 +119,16 @@ void redisAsyncHandleWrite(redisAsyncContext *ac);
 int redisAsyncHandleWritePrep(redisAsyncContext *ac);
 int redisAsyncHandleWriteComplete(redisAsyncContext *ac, int written);
 #endif
+/* Dispatch the replies already fed to the reader, for event loops that do
+ * their own reads. */
+void redisProcessCallbacks(redisAsyncContext *ac);
 
 /* Command functions for an async context. Write the command to the
  * output buffer and register the provided callback. */
 int redisvAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *format, va_list ap);
 int redisAsyncCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *format, ...);
 int redisAsyncCommandArgv(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, int argc, const char **argv, const size_t *argvlen);
+int redisAsyncFormattedCommand(redisAsyncContext *ac, redisCallbackFn *fn, void *privdata, const char *cmd, size_t len);
 
 #ifdef __cplusplus
 }